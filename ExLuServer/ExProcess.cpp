@@ -5,10 +5,23 @@
 #include <iterator>
 #include <sstream>
 #include "hoops_license.h"
+#include "utilities.h"
 
-static double s_dUnit = 1.0;
+// Bump when the load options, the SC export or the scene file layout change
+static const int s_conversionCacheVersion = 2;
 
-ExProcess::ExProcess()
+static void deleteModelFile(A3DAsmModelFile* pModelFile)
+{
+    // Release the PRC ID map, then the model file
+    A3DStatus iRet = A3DPrcIdMapCreate(pModelFile, 0);
+
+    iRet = A3DAsmModelFileDelete(pModelFile);
+    if (iRet == A3D_SUCCESS)
+        printf("ModelFile was removed.\n");
+}
+
+ExProcess::ExProcess() :
+    m_cacheDir("../ConversionCache")
 {
 }
 
@@ -60,6 +73,9 @@ bool ExProcess::Init()
     if (!m_libImporter.Init(&m_libConverter))
         return false;
 
+    if (!make_dir(m_cacheDir.c_str()))
+        printf("Conversion cache is not available: %s\n", m_cacheDir.c_str());
+
     return true;
 }
 
@@ -75,6 +91,8 @@ void ExProcess::Terminate()
 
 void ExProcess::SetOptions()
 {
+    std::lock_guard<std::recursive_mutex> lock(m_exchangeMutex);
+
     // Init import options
     A3D_INITIALIZE_DATA(A3DRWParamsLoadData, m_sLoadData);
     m_sLoadData.m_sGeneral.m_bReadSolids = true;
@@ -97,26 +115,30 @@ void ExProcess::SetOptions()
     m_sLoadData.m_sSpecifics.m_sRevit.m_eMultiThreadedMode = kA3DRevitMultiThreadedMode_Disabled;
 }
 
-void ExProcess::DeleteModelFile(const char* session_id)
+void ExProcess::DeleteSceneData(const char* session_id)
 {
-    // Delete loaded modelFile
-    if (1 == m_mModelFile.count(session_id))
-    {
-        A3DAsmModelFile* pModelFile = m_mModelFile[session_id];
-        m_mModelFile.erase(session_id);
+    std::lock_guard<std::recursive_mutex> lock(m_exchangeMutex);
 
-        A3DStatus iRet = A3DPrcIdMapCreate(pModelFile, 0);
-
-        iRet = A3DAsmModelFileDelete(pModelFile);
-        if (iRet == A3D_SUCCESS)
-            printf("ModelFile was removed.\n");
-    }
+    m_mSceneData.erase(session_id);
 }
 
-bool ExProcess::LoadFile(const char* session_id, const char* file_name, const char* sc_name)
+bool ExProcess::LoadFile(const char* session_id, const char* file_name, const char* sc_name,
+    std::function<void(hoops_luminate_bridge::ExSceneDataPtr)> onSceneExtracted)
 {
+    std::lock_guard<std::recursive_mutex> lock(m_exchangeMutex);
+
     A3DStatus iRet;
 
+    // A file converted before with the same options skips loading and tessellation
+    std::string cacheKey;
+    if (getConversionKey(file_name, cacheKey) && loadFromCache(session_id, cacheKey, sc_name))
+    {
+        printf("Model was read from the conversion cache: %s\n", cacheKey.c_str());
+        if (onSceneExtracted)
+            onSceneExtracted(m_mSceneData[session_id]);
+        return true;
+    }
+
     A3DAsmModelFile* pModelFile;
 
     iRet = A3DAsmModelFileLoadFromFile(file_name, &m_sLoadData, &pModelFile);
@@ -127,16 +149,43 @@ bool ExProcess::LoadFile(const char* session_id, const char* file_name, const ch
         return false;
     }
     printf("Model was loaded\n");
-    m_mModelFile.insert(std::make_pair(session_id, pModelFile));
 
     A3DPrcIdMap* pMap = nullptr;
     iRet = A3DPrcIdMapCreate(pModelFile, &pMap);
     if (A3D_SUCCESS != iRet || nullptr == pMap)
+    {
+        deleteModelFile(pModelFile);
         return false;
+    }
 
-    m_mPrcIdMap.insert(std::make_pair(session_id, pMap));
+    // Luminate builds its scene from the extracted data: extract before the SC export
+    // so that the Luminate scene is built while the SC model is written.
+    // Exchange calls stay serialized on this thread
+    hoops_luminate_bridge::ExSceneDataPtr sceneData = hoops_luminate_bridge::extractExScene(pModelFile, pMap);
+    m_mSceneData[session_id] = sceneData;
+
+    if (onSceneExtracted)
+        onSceneExtracted(sceneData);
 
     // HC libconverter
+    bool bExported = exportSC(pModelFile, sc_name);
+
+    // The session only needs the extracted scene and the SC model from now on
+    deleteModelFile(pModelFile);
+
+    if (!bExported)
+        return false;
+    printf("SC model was exported\n");
+
+    // The extracted scene is cached with the SC model
+    if (!cacheKey.empty())
+        storeToCache(cacheKey, sc_name, *sceneData);
+
+    return true;
+}
+
+bool ExProcess::exportSC(A3DAsmModelFile* pModelFile, const char* sc_name)
+{
     if (!m_libImporter.Load(pModelFile))
         return false;
 
@@ -149,19 +198,93 @@ bool ExProcess::LoadFile(const char* session_id, const char* file_name, const ch
     exportOptions.export_attributes = true;
     exportOptions.export_exchange_ids = true;
 
-    if (!exporter.WriteSC(nullptr, sc_name, exportOptions))
+    return exporter.WriteSC(nullptr, sc_name, exportOptions);
+}
+
+hoops_luminate_bridge::ExSceneDataPtr ExProcess::GetSceneData(const char* session_id)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_exchangeMutex);
+
+    if (0 == m_mSceneData.count(session_id))
+        return nullptr;
+
+    return m_mSceneData[session_id];
+}
+
+bool ExProcess::getConversionKey(const char* file_name, std::string& key)
+{
+    // Every option changing the conversion result is part of the key
+    char lowExt[256] = { '\0' };
+    char fileType[256] = { '\0' };
+    getLowerExtention(file_name, lowExt, fileType);
+
+    const A3DRWParamsGeneralData& general = m_sLoadData.m_sGeneral;
+    char options[1024];
+    snprintf(options, sizeof(options), "%d|%s|%d%d%d%d%d%d%d%d|%d|%d|%d|%d|%d|%d|%d|%s|%d",
+        s_conversionCacheVersion, lowExt,
+        general.m_bReadSolids, general.m_bReadSurfaces, general.m_bReadWireframes, general.m_bReadPmis,
+        general.m_bReadAttributes, general.m_bReadHiddenObjects, general.m_bReadConstructionAndReferences, general.m_bReadActiveFilter,
+        (int)general.m_eReadingMode2D3D, (int)general.m_eReadGeomTessMode, (int)general.m_eDefaultUnit,
+        (int)m_sLoadData.m_sTessellation.m_eTessellationLevelOfDetail,
+        m_sLoadData.m_sAssembly.m_bUseRootDirectory, m_sLoadData.m_sMultiEntries.m_bLoadDefault,
+        m_sLoadData.m_sPmi.m_bAlwaysSubstituteFont,
+        NULL != m_sLoadData.m_sPmi.m_pcSubstitutionFont ? m_sLoadData.m_sPmi.m_pcSubstitutionFont : "",
+        (int)m_sLoadData.m_sSpecifics.m_sRevit.m_eMultiThreadedMode);
+
+    // The cache is shared by every session: a collision resistant digest keeps an upload from
+    // being answered with the conversion of another file
+    return sha256_file(file_name, options, key);
+}
+
+bool ExProcess::loadFromCache(const char* session_id, const std::string& key, const char* sc_name)
+{
+    std::string entryDir = m_cacheDir + "/" + key;
+    std::string cachedScPath = entryDir + "/model.scs";
+    std::string cachedScenePath = entryDir + "/scene.exsc";
+
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+
+    // The scene file is written last, an entry without it is incomplete
+    if (!file_exists(cachedScPath.c_str()) || !file_exists(cachedScenePath.c_str()))
         return false;
-    printf("SC model was exported\n");
+
+    hoops_luminate_bridge::ExSceneDataPtr sceneData = hoops_luminate_bridge::readExScene(cachedScenePath);
+    if (nullptr == sceneData)
+        return false;
+
+    copy_file(cachedScPath.c_str(), sc_name);
+    if (get_file_size(sc_name) != get_file_size(cachedScPath.c_str()))
+        return false;
+
+    m_mSceneData[session_id] = sceneData;
 
     return true;
 }
 
-A3DAsmModelFile* ExProcess::GetModelFile(const char* session_id, A3DEntity*& pPrcIdMap)
+void ExProcess::storeToCache(const std::string& key, const char* sc_name, const hoops_luminate_bridge::ExSceneData& sceneData)
 {
-    if (0 == m_mModelFile.count(session_id) || 0 == m_mPrcIdMap.count(session_id))
-        return nullptr;
+    std::string entryDir = m_cacheDir + "/" + key;
+
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+
+    if (!make_dir(entryDir.c_str()))
+        return;
 
-    pPrcIdMap = m_mPrcIdMap[session_id];
+    std::string cachedScPath = entryDir + "/model.scs";
+    copy_file(sc_name, cachedScPath.c_str());
+
+    // Write aside then rename so that a partial scene file is never read
+    std::string cachedScenePath = entryDir + "/scene.exsc";
+    std::string tempScenePath = cachedScenePath + ".tmp";
+    if (!hoops_luminate_bridge::writeExScene(sceneData, tempScenePath))
+    {
+        remove(tempScenePath.c_str());
+        return;
+    }
 
-    return m_mModelFile[session_id];
+    remove(cachedScenePath.c_str());
+    if (0 != rename(tempScenePath.c_str(), cachedScenePath.c_str()))
+        remove(tempScenePath.c_str());
+    else
+        printf("Conversion was cached: %s\n", key.c_str());
 }
@@ -2,9 +2,12 @@
 #include <A3DSDKIncludes.h>
 
 #include "libconverter.h"
+#include "hoops_luminate_bridge/include/hoops_luminate_bridge/HoopsExLuminateBridge.h"
 #include<string>
 #include <vector>
 #include <map>
+#include <mutex>
+#include <functional>
 
 using namespace Communicator;
 using string_t = std::basic_string<A3DUniChar>;
@@ -16,19 +19,30 @@ public:
 	~ExProcess();
 
 private:
-	std::map<std::string, A3DAsmModelFile*> m_mModelFile;
-	std::map<std::string, A3DEntity*> m_mPrcIdMap;
+	// Scene extracted at upload, the model file is deleted once it is exported
+	std::map<std::string, hoops_luminate_bridge::ExSceneDataPtr> m_mSceneData;
     A3DRWParamsLoadData m_sLoadData;
 	Converter m_libConverter;
 	Importer m_libImporter; // Import Initialization
+	std::recursive_mutex m_exchangeMutex; // HOOPS Exchange is shared by every session
+
+	// Conversion results of previous uploads, keyed by file content and load options
+	std::string m_cacheDir;
+	std::mutex m_cacheMutex;
+
+	bool exportSC(A3DAsmModelFile* pModelFile, const char* sc_name);
+	bool getConversionKey(const char* file_name, std::string& key);
+	bool loadFromCache(const char* session_id, const std::string& key, const char* sc_name);
+	void storeToCache(const std::string& key, const char* sc_name, const hoops_luminate_bridge::ExSceneData& sceneData);
 
 public:
 	bool Init();
 	void Terminate();
 
 	void SetOptions();
-	void DeleteModelFile(const char* session_id);
-	bool LoadFile(const char* session_id, const char* file_name, const char* sc_name);
-	A3DAsmModelFile* GetModelFile(const char* session_id, A3DEntity*& pPrcIdMap);
+	void DeleteSceneData(const char* session_id);
+	bool LoadFile(const char* session_id, const char* file_name, const char* sc_name,
+		std::function<void(hoops_luminate_bridge::ExSceneDataPtr)> onSceneExtracted = nullptr);
+	hoops_luminate_bridge::ExSceneDataPtr GetSceneData(const char* session_id);
 };
 
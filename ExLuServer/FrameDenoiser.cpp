@@ -0,0 +1,312 @@
+#include "FrameDenoiser.h"
+#include <math.h>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && 2 <= _M_IX86_FP)
+#include <emmintrin.h>
+#define FRAME_DENOISER_SSE2
+#endif
+
+namespace
+{
+    //////////////////////////////////////////
+    // Parallel bands
+    //////////////////////////////////////////
+
+    // Denoising shares the cores with the Luminate tracer, keep a few of them only
+    const unsigned int kMaxDenoiserThreads = 4;
+
+    // Below this many pixels, handing bands over costs more than filtering on the caller
+    const size_t kMinParallelPixels = 256 * 256;
+
+    // Workers started once for the process, the bands of a pass are taken by them and the caller
+    class BandPool
+    {
+    public:
+        BandPool() : m_bandCount(0), m_nextBand(0), m_pendingBands(0), m_generation(0)
+        {
+            unsigned int threadCount = std::min(kMaxDenoiserThreads, std::max(1u, std::thread::hardware_concurrency()));
+            for (unsigned int i = 1; i < threadCount; i++)
+                std::thread(&BandPool::workerLoop, this).detach();
+            m_threadCount = (int)threadCount;
+        }
+
+        int getThreadCount() const { return m_threadCount; }
+
+        // One frame at a time, other callers filter on their own thread meanwhile
+        std::mutex& getRunMutex() { return m_runMutex; }
+
+        void run(const int bandCount, const std::function<void(int)>& band)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_band = band;
+            m_bandCount = bandCount;
+            m_nextBand = 0;
+            m_pendingBands = bandCount;
+            m_generation++;
+            m_wakeCondition.notify_all();
+
+            takeBands(lock);
+            m_doneCondition.wait(lock, [this]() { return 0 == m_pendingBands; });
+        }
+
+    private:
+        std::mutex m_runMutex;
+        std::mutex m_mutex;
+        std::condition_variable m_wakeCondition;
+        std::condition_variable m_doneCondition;
+        std::function<void(int)> m_band;
+        int m_threadCount;
+        int m_bandCount;
+        int m_nextBand;
+        int m_pendingBands;
+        unsigned int m_generation;
+
+        void workerLoop()
+        {
+            unsigned int generation = 0;
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (true)
+            {
+                m_wakeCondition.wait(lock, [&]() { return generation != m_generation; });
+                generation = m_generation;
+                takeBands(lock);
+            }
+        }
+
+        void takeBands(std::unique_lock<std::mutex>& lock)
+        {
+            while (m_nextBand < m_bandCount)
+            {
+                int band = m_nextBand++;
+                lock.unlock();
+                m_band(band);
+                lock.lock();
+
+                if (0 == --m_pendingBands)
+                    m_doneCondition.notify_all();
+            }
+        }
+    };
+
+    void runBands(const int rowCount, const size_t pixelCount, std::function<void(int, int)> band)
+    {
+        // Kept for the process, its workers wait on a condition between frames
+        static BandPool* pool = new BandPool();
+
+        int bandCount = 1;
+        if (kMinParallelPixels <= pixelCount)
+            bandCount = std::max(1, std::min(pool->getThreadCount(), rowCount / 16));
+
+        std::unique_lock<std::mutex> runLock(pool->getRunMutex(), std::defer_lock);
+        if (1 == bandCount || !runLock.try_lock())
+        {
+            band(0, rowCount);
+            return;
+        }
+
+        pool->run(bandCount, [&](int i) { band(rowCount * i / bandCount, rowCount * (i + 1) / bandCount); });
+    }
+
+    //////////////////////////////////////////
+    // Edge-avoiding a-trous filter
+    //////////////////////////////////////////
+
+    const float kKernel[5] = { 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
+    // Edge tolerance, as a squared distance between neighbouring pixels in [0, 1]
+    const float kColorSigma2 = 0.25f;
+
+    // The color being filtered is its own guide
+    struct Pass
+    {
+        int width;
+        int height;
+        int step;
+        const float* src[3];
+        float* dst[3];
+        float colorInvSigma2;
+    };
+
+    // exp(x) for x <= 0 as (1 + x / 256)^256: edge weights only need a few digits
+    inline float expNegative(const float x)
+    {
+        float y = std::max(0.f, 1.f + x * (1.f / 256.f));
+        for (int i = 0; i < 8; i++)
+            y *= y;
+        return y;
+    }
+
+    void filterPixel(const Pass& pass, const int x, const int y)
+    {
+        const size_t center = (size_t)y * pass.width + x;
+
+        float sum[3] = { 0.f, 0.f, 0.f };
+        float weightSum = 0.f;
+
+        for (int j = 0; j < 5; j++)
+        {
+            int qy = std::min(std::max(y + (j - 2) * pass.step, 0), pass.height - 1);
+            for (int i = 0; i < 5; i++)
+            {
+                int qx = std::min(std::max(x + (i - 2) * pass.step, 0), pass.width - 1);
+                const size_t tap = (size_t)qy * pass.width + qx;
+
+                float color[3];
+                float distance2 = 0.f;
+                for (int c = 0; c < 3; c++)
+                {
+                    color[c] = pass.src[c][tap];
+                    float d = color[c] - pass.src[c][center];
+                    distance2 += d * d;
+                }
+
+                float weight = kKernel[i] * kKernel[j] * expNegative(-distance2 * pass.colorInvSigma2);
+                for (int c = 0; c < 3; c++)
+                    sum[c] += weight * color[c];
+                weightSum += weight;
+            }
+        }
+
+        // The center tap always weighs (3 / 8)^2
+        for (int c = 0; c < 3; c++)
+            pass.dst[c][center] = sum[c] / weightSum;
+    }
+
+#ifdef FRAME_DENOISER_SSE2
+    inline __m128 expNegative4(const __m128 x)
+    {
+        __m128 y = _mm_max_ps(_mm_setzero_ps(), _mm_add_ps(_mm_set1_ps(1.f), _mm_mul_ps(x, _mm_set1_ps(1.f / 256.f))));
+        y = _mm_mul_ps(y, y);
+        y = _mm_mul_ps(y, y);
+        y = _mm_mul_ps(y, y);
+        y = _mm_mul_ps(y, y);
+        y = _mm_mul_ps(y, y);
+        y = _mm_mul_ps(y, y);
+        y = _mm_mul_ps(y, y);
+        return _mm_mul_ps(y, y);
+    }
+
+    // 4 neighbouring pixels of a row, the whole kernel footprint must lie inside the frame horizontally
+    void filterPixels4(const Pass& pass, const int x, const int y)
+    {
+        const size_t center = (size_t)y * pass.width + x;
+
+        __m128 centerColor[3];
+        for (int c = 0; c < 3; c++)
+            centerColor[c] = _mm_loadu_ps(pass.src[c] + center);
+
+        __m128 sum[3] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+        __m128 weightSum = _mm_setzero_ps();
+
+        for (int j = 0; j < 5; j++)
+        {
+            int qy = std::min(std::max(y + (j - 2) * pass.step, 0), pass.height - 1);
+            for (int i = 0; i < 5; i++)
+            {
+                const size_t tap = (size_t)qy * pass.width + x + (i - 2) * pass.step;
+
+                __m128 color[3];
+                __m128 colorDistance2 = _mm_setzero_ps();
+                for (int c = 0; c < 3; c++)
+                {
+                    color[c] = _mm_loadu_ps(pass.src[c] + tap);
+                    __m128 d = _mm_sub_ps(color[c], centerColor[c]);
+                    colorDistance2 = _mm_add_ps(colorDistance2, _mm_mul_ps(d, d));
+                }
+
+                __m128 exponent = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(colorDistance2, _mm_set1_ps(pass.colorInvSigma2)));
+
+                __m128 weight = _mm_mul_ps(_mm_set1_ps(kKernel[i] * kKernel[j]), expNegative4(exponent));
+                for (int c = 0; c < 3; c++)
+                    sum[c] = _mm_add_ps(sum[c], _mm_mul_ps(weight, color[c]));
+                weightSum = _mm_add_ps(weightSum, weight);
+            }
+        }
+
+        for (int c = 0; c < 3; c++)
+            _mm_storeu_ps(pass.dst[c] + center, _mm_div_ps(sum[c], weightSum));
+    }
+#endif
+
+    void filterRows(const Pass& pass, const int y0, const int y1)
+    {
+        const int margin = 2 * pass.step;
+
+        for (int y = y0; y < y1; y++)
+        {
+            int x = 0;
+#ifdef FRAME_DENOISER_SSE2
+            for (; x < margin && x < pass.width; x++)
+                filterPixel(pass, x, y);
+            for (; x + 4 + margin <= pass.width; x += 4)
+                filterPixels4(pass, x, y);
+#endif
+            for (; x < pass.width; x++)
+                filterPixel(pass, x, y);
+        }
+    }
+
+    void toPlanes(const unsigned char* rgba, const size_t pixelCount, std::vector<float> planes[3])
+    {
+        for (int c = 0; c < 3; c++)
+            planes[c].resize(pixelCount);
+
+        for (size_t p = 0; p < pixelCount; p++)
+        {
+            for (int c = 0; c < 3; c++)
+                planes[c][p] = rgba[p * 4 + c] * (1.f / 255.f);
+        }
+    }
+}
+
+bool denoiseFrame(unsigned char* rgba, const int width, const int height, const int iterations, const float strength)
+{
+    if (NULL == rgba || width <= 0 || height <= 0)
+        return false;
+
+    if (iterations <= 0 || strength <= 0.f)
+        return true;
+
+    const size_t pixelCount = (size_t)width * height;
+
+    std::vector<float> color[2][3];
+    toPlanes(rgba, pixelCount, color[0]);
+    for (int c = 0; c < 3; c++)
+        color[1][c].resize(pixelCount);
+
+    const float colorSigma2 = kColorSigma2 * std::min(strength, 1.f) * std::min(strength, 1.f);
+
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        const int src = iteration % 2;
+
+        Pass pass;
+        pass.width = width;
+        pass.height = height;
+        pass.step = 1 << iteration;
+        for (int c = 0; c < 3; c++)
+        {
+            pass.src[c] = &color[src][c][0];
+            pass.dst[c] = &color[1 - src][c][0];
+        }
+
+        // The color tolerance shrinks as the kernel widens, the noise left is finer than the edges
+        pass.colorInvSigma2 = (float)(1 << iteration) / colorSigma2;
+
+        runBands(height, pixelCount, [&pass](int y0, int y1) { filterRows(pass, y0, y1); });
+    }
+
+    const std::vector<float>* result = color[iterations % 2];
+    for (size_t p = 0; p < pixelCount; p++)
+    {
+        for (int c = 0; c < 3; c++)
+            rgba[p * 4 + c] = (unsigned char)(std::min(std::max(result[c][p], 0.f), 1.f) * 255.f + 0.5f);
+    }
+
+    return true;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <stddef.h>
+
+/**
+ * Smooth the noise of an early progressive frame in place, before it is encoded.
+ * Edge-avoiding a-trous wavelet filter: each iteration doubles the spacing of a 5x5
+ * B3-spline kernel whose taps are weighted down across color edges. Rows of large frames
+ * are filtered by a few persistent worker threads, 4 pixels at once.
+ * @param[in,out] rgba Pixels, 4 bytes per pixel, rows stored top-down. Alpha is kept.
+ * @param[in] width Frame width.
+ * @param[in] height Frame height.
+ * @param[in] iterations Number of kernel spacings (1, 2, 4...), the filter radius is 2^(iterations + 1) - 2.
+ * @param[in] strength 0 (no filtering) to 1 (strongest), scales the color edge tolerance.
+ * @return True if success, otherwise False.
+ */
+bool denoiseFrame(unsigned char* rgba, const int width, const int height, const int iterations, const float strength);
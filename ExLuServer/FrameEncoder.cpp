@@ -0,0 +1,999 @@
+#include "FrameEncoder.h"
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+namespace
+{
+    //////////////////////////////////////////
+    // Parallel bands
+    //////////////////////////////////////////
+
+    // Encoding shares the cores with the Luminate tracer, keep a few of them only
+    const unsigned int kMaxEncoderThreads = 4;
+
+    // Below this many pixels, starting threads costs more than encoding on the caller
+    const size_t kMinParallelPixels = 512 * 512;
+
+    // Small images such as tiles end up with a single band
+    int getBandCount(const int units)
+    {
+        unsigned int threadCount = std::min(kMaxEncoderThreads, std::max(1u, std::thread::hardware_concurrency()));
+        return std::max(1, std::min((int)threadCount, units));
+    }
+
+    void runBands(const int bandCount, std::function<void(int)> band)
+    {
+        std::vector<std::thread> threads;
+        for (int i = 1; i < bandCount; i++)
+            threads.push_back(std::thread(band, i));
+
+        band(0);
+
+        for (size_t i = 0; i < threads.size(); i++)
+            threads[i].join();
+    }
+
+    //////////////////////////////////////////
+    // Checksums
+    //////////////////////////////////////////
+
+    struct CrcTable
+    {
+        uint32_t values[256];
+
+        CrcTable()
+        {
+            for (uint32_t n = 0; n < 256; n++)
+            {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++)
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                values[n] = c;
+            }
+        }
+    };
+
+    uint32_t computeCrc(const unsigned char* data, const size_t size)
+    {
+        static const CrcTable table;
+
+        uint32_t crc = 0xffffffffu;
+        for (size_t i = 0; i < size; i++)
+            crc = table.values[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+        return crc ^ 0xffffffffu;
+    }
+
+    uint32_t computeAdler32(const unsigned char* data, const size_t size)
+    {
+        const uint32_t mod = 65521;
+        uint32_t a = 1, b = 0;
+
+        size_t pos = 0;
+        while (pos < size)
+        {
+            // 5552 is the largest block keeping b below 2^32 before the modulo
+            size_t blockEnd = pos + 5552 < size ? pos + 5552 : size;
+            for (; pos < blockEnd; pos++)
+            {
+                a += data[pos];
+                b += a;
+            }
+            a %= mod;
+            b %= mod;
+        }
+
+        return (b << 16) | a;
+    }
+
+    //////////////////////////////////////////
+    // Deflate with fixed Huffman codes
+    //////////////////////////////////////////
+
+    const int kWindowSize = 32768;
+    const int kHashBits = 15;
+    const int kMaxChain = 32;
+    const int kMaxChainFast = 4;
+    const int kMinMatch = 3;
+    const int kMaxMatch = 258;
+
+    const int kLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    const int kLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const int kDistBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    const int kDistExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    struct SymbolTables
+    {
+        unsigned char lengthCode[kMaxMatch + 1];
+        unsigned char distCode[kWindowSize + 1];
+
+        SymbolTables()
+        {
+            int code = 0;
+            for (int len = kMinMatch; len <= kMaxMatch; len++)
+            {
+                while (code < 28 && len >= kLengthBase[code + 1])
+                    code++;
+                lengthCode[len] = (unsigned char)code;
+            }
+
+            code = 0;
+            for (int dist = 1; dist <= kWindowSize; dist++)
+            {
+                while (code < 29 && dist >= kDistBase[code + 1])
+                    code++;
+                distCode[dist] = (unsigned char)code;
+            }
+        }
+    };
+
+    class BitWriter
+    {
+    public:
+        BitWriter(std::vector<unsigned char>& out) : m_out(out), m_bitBuffer(0), m_bitCount(0) {}
+
+        // Deflate packs data bits starting from the least significant one
+        void writeBits(const uint32_t bits, const int count)
+        {
+            m_bitBuffer |= bits << m_bitCount;
+            m_bitCount += count;
+            while (8 <= m_bitCount)
+            {
+                m_out.push_back((unsigned char)(m_bitBuffer & 0xff));
+                m_bitBuffer >>= 8;
+                m_bitCount -= 8;
+            }
+        }
+
+        // Huffman codes are packed starting from their most significant bit
+        void writeCode(const uint32_t code, const int length)
+        {
+            uint32_t reversed = 0;
+            for (int i = 0; i < length; i++)
+                reversed |= ((code >> i) & 1) << (length - 1 - i);
+            writeBits(reversed, length);
+        }
+
+        void flush()
+        {
+            if (0 < m_bitCount)
+                m_out.push_back((unsigned char)(m_bitBuffer & 0xff));
+            m_bitBuffer = 0;
+            m_bitCount = 0;
+        }
+
+    private:
+        std::vector<unsigned char>& m_out;
+        uint32_t m_bitBuffer;
+        int m_bitCount;
+    };
+
+    void writeLiteral(BitWriter& writer, const int symbol)
+    {
+        if (symbol < 144)
+            writer.writeCode(0x30 + symbol, 8);
+        else if (symbol < 256)
+            writer.writeCode(0x190 + symbol - 144, 9);
+        else if (symbol < 280)
+            writer.writeCode(symbol - 256, 7);
+        else
+            writer.writeCode(0xc0 + symbol - 280, 8);
+    }
+
+    void writeMatch(BitWriter& writer, const SymbolTables& tables, const int length, const int dist)
+    {
+        int lengthCode = tables.lengthCode[length];
+        writeLiteral(writer, 257 + lengthCode);
+        if (kLengthExtra[lengthCode])
+            writer.writeBits(length - kLengthBase[lengthCode], kLengthExtra[lengthCode]);
+
+        int distCode = tables.distCode[dist];
+        writer.writeCode(distCode, 5);
+        if (kDistExtra[distCode])
+            writer.writeBits(dist - kDistBase[distCode], kDistExtra[distCode]);
+    }
+
+    uint32_t hash3(const unsigned char* p)
+    {
+        uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+        return (v * 2654435761u) >> (32 - kHashBits);
+    }
+
+    // Compress one band as a fixed Huffman block. Bands other than the final
+    // one end with an empty stored block so that they stop on a byte boundary
+    // and can be concatenated.
+    void deflateFixed(const unsigned char* data, const size_t size, std::vector<unsigned char>& out, const int maxChain, const bool final)
+    {
+        static const SymbolTables tables;
+
+        BitWriter writer(out);
+        writer.writeBits(final ? 1 : 0, 1); // BFINAL
+        writer.writeBits(1, 2); // BTYPE: fixed Huffman
+
+        std::vector<int> head(1 << kHashBits, -1);
+        std::vector<int> prev(kWindowSize, -1);
+
+        size_t pos = 0;
+        while (pos < size)
+        {
+            int bestLength = 0;
+            int bestDist = 0;
+
+            if (pos + kMinMatch <= size)
+            {
+                size_t maxLength = size - pos < (size_t)kMaxMatch ? size - pos : (size_t)kMaxMatch;
+                int candidate = head[hash3(data + pos)];
+                int chain = maxChain;
+
+                while (0 <= candidate && (int)(pos - candidate) <= kWindowSize && 0 < chain--)
+                {
+                    const unsigned char* a = data + candidate;
+                    const unsigned char* b = data + pos;
+                    size_t length = 0;
+                    while (length < maxLength && a[length] == b[length])
+                        length++;
+
+                    if ((int)length > bestLength)
+                    {
+                        bestLength = (int)length;
+                        bestDist = (int)(pos - candidate);
+                        if (length == maxLength)
+                            break;
+                    }
+
+                    int next = prev[candidate & (kWindowSize - 1)];
+                    if (next >= candidate)
+                        break;
+                    candidate = next;
+                }
+            }
+
+            size_t advance = 1;
+            if (kMinMatch <= bestLength)
+            {
+                writeMatch(writer, tables, bestLength, bestDist);
+                advance = bestLength;
+            }
+            else
+            {
+                writeLiteral(writer, data[pos]);
+            }
+
+            // Register every covered position in the hash chains
+            for (size_t i = 0; i < advance; i++, pos++)
+            {
+                if (pos + kMinMatch <= size)
+                {
+                    uint32_t h = hash3(data + pos);
+                    prev[pos & (kWindowSize - 1)] = head[h];
+                    head[h] = (int)pos;
+                }
+            }
+        }
+
+        writeLiteral(writer, 256); // end of block
+
+        if (!final)
+        {
+            writer.writeBits(0, 1); // BFINAL
+            writer.writeBits(0, 2); // BTYPE: stored
+            writer.flush();
+            out.push_back(0x00);
+            out.push_back(0x00);
+            out.push_back(0xff);
+            out.push_back(0xff);
+        }
+        writer.flush();
+    }
+
+    //////////////////////////////////////////
+    // PNG
+    //////////////////////////////////////////
+
+    void writeUint32(std::vector<unsigned char>& out, const uint32_t value)
+    {
+        out.push_back((unsigned char)(value >> 24));
+        out.push_back((unsigned char)(value >> 16));
+        out.push_back((unsigned char)(value >> 8));
+        out.push_back((unsigned char)value);
+    }
+
+    void writeChunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, const size_t size)
+    {
+        writeUint32(out, (uint32_t)size);
+
+        size_t crcStart = out.size();
+        out.insert(out.end(), type, type + 4);
+        if (0 < size)
+            out.insert(out.end(), data, data + size);
+
+        writeUint32(out, computeCrc(&out[crcStart], out.size() - crcStart));
+    }
+
+    int paeth(const int a, const int b, const int c)
+    {
+        int p = a + b - c;
+        int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+        if (pa <= pb && pa <= pc) return a;
+        if (pb <= pc) return b;
+        return c;
+    }
+
+    // Filter one scanline with the five PNG filters and keep the one
+    // with the smallest sum of absolute differences. The fast mode
+    // only uses the Sub filter.
+    void filterRow(const unsigned char* row, const unsigned char* prevRow, const int rowSize, unsigned char* out, std::vector<unsigned char>& scratch, const bool fast)
+    {
+        const int bpp = 4;
+        scratch.resize(rowSize);
+
+        if (fast)
+        {
+            out[0] = 1;
+            for (int i = 0; i < rowSize; i++)
+                out[1 + i] = (unsigned char)(row[i] - (i >= bpp ? row[i - bpp] : 0));
+            return;
+        }
+
+        long bestSum = -1;
+        for (int filter = 0; filter < 5; filter++)
+        {
+            long sum = 0;
+            for (int i = 0; i < rowSize; i++)
+            {
+                int left = i >= bpp ? row[i - bpp] : 0;
+                int up = prevRow ? prevRow[i] : 0;
+                int upLeft = (prevRow && i >= bpp) ? prevRow[i - bpp] : 0;
+
+                int predicted = 0;
+                switch (filter)
+                {
+                case 1: predicted = left; break;
+                case 2: predicted = up; break;
+                case 3: predicted = (left + up) / 2; break;
+                case 4: predicted = paeth(left, up, upLeft); break;
+                default: break;
+                }
+
+                unsigned char value = (unsigned char)(row[i] - predicted);
+                scratch[i] = value;
+                sum += value < 128 ? value : 256 - value;
+            }
+
+            if (bestSum < 0 || sum < bestSum)
+            {
+                bestSum = sum;
+                out[0] = (unsigned char)filter;
+                memcpy(out + 1, &scratch[0], rowSize);
+            }
+        }
+    }
+}
+
+bool encodePng(const unsigned char* rgba, const int width, const int height, std::vector<unsigned char>& png, const bool fast)
+{
+    if (NULL == rgba || 0 >= width || 0 >= height)
+        return false;
+
+    const int rowSize = width * 4;
+    const size_t lineSize = (size_t)rowSize + 1;
+
+    // Bands of scanlines are filtered and compressed independently
+    const int bandCount = getBandCount(height / 64);
+    const int bandHeight = (height + bandCount - 1) / bandCount;
+
+    // Filtered scanlines, each one prefixed by its filter type
+    std::vector<unsigned char> filtered(lineSize * height);
+    std::vector<std::vector<unsigned char>> compressed(bandCount);
+
+    runBands(bandCount, [&](int band) {
+        const int y0 = band * bandHeight;
+        const int y1 = std::min(height, y0 + bandHeight);
+        if (y0 >= y1)
+            return;
+
+        std::vector<unsigned char> scratch;
+        for (int y = y0; y < y1; y++)
+        {
+            const unsigned char* row = rgba + (size_t)y * rowSize;
+            const unsigned char* prevRow = 0 < y ? row - rowSize : NULL;
+            filterRow(row, prevRow, rowSize, &filtered[(size_t)y * lineSize], scratch, fast);
+        }
+
+        const bool final = y1 == height;
+        compressed[band].reserve(lineSize * (y1 - y0) / 2);
+        deflateFixed(&filtered[(size_t)y0 * lineSize], lineSize * (y1 - y0), compressed[band], fast ? kMaxChainFast : kMaxChain, final);
+    });
+
+    // zlib stream
+    std::vector<unsigned char> idat;
+    idat.push_back(0x78);
+    idat.push_back(0x01);
+    for (int band = 0; band < bandCount; band++)
+        idat.insert(idat.end(), compressed[band].begin(), compressed[band].end());
+    writeUint32(idat, computeAdler32(&filtered[0], filtered.size()));
+
+    png.clear();
+    png.reserve(idat.size() + 64);
+
+    const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a };
+    png.insert(png.end(), signature, signature + 8);
+
+    std::vector<unsigned char> ihdr;
+    writeUint32(ihdr, (uint32_t)width);
+    writeUint32(ihdr, (uint32_t)height);
+    ihdr.push_back(8); // bit depth
+    ihdr.push_back(6); // RGBA
+    ihdr.push_back(0); // deflate
+    ihdr.push_back(0); // adaptive filtering
+    ihdr.push_back(0); // no interlace
+    writeChunk(png, "IHDR", &ihdr[0], ihdr.size());
+
+    writeChunk(png, "IDAT", &idat[0], idat.size());
+    writeChunk(png, "IEND", NULL, 0);
+
+    return true;
+}
+
+namespace
+{
+    //////////////////////////////////////////
+    // Baseline JPEG
+    //////////////////////////////////////////
+
+    // Natural order index of each zigzag position
+    const int kZigZag[64] = { 0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+        12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+        35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+        58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63 };
+
+    const int kLuminanceQuant[64] = { 16, 11, 10, 16, 24, 40, 51, 61,
+        12, 12, 14, 19, 26, 58, 60, 55,
+        14, 13, 16, 24, 40, 57, 69, 56,
+        14, 17, 22, 29, 51, 87, 80, 62,
+        18, 22, 37, 56, 68, 109, 103, 77,
+        24, 35, 55, 64, 81, 104, 113, 92,
+        49, 64, 78, 87, 103, 121, 120, 101,
+        72, 92, 95, 98, 112, 100, 103, 99 };
+
+    const int kChrominanceQuant[64] = { 17, 18, 24, 47, 99, 99, 99, 99,
+        18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99,
+        47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99 };
+
+    // Standard Huffman tables: code count per length, then symbols
+    const unsigned char kDcLuminanceBits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+    const unsigned char kDcLuminanceValues[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+    const unsigned char kDcChrominanceBits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+    const unsigned char kDcChrominanceValues[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+    const unsigned char kAcLuminanceBits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+    const unsigned char kAcLuminanceValues[162] = {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+        0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+        0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+        0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+        0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+        0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+        0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+        0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+        0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa };
+
+    const unsigned char kAcChrominanceBits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+    const unsigned char kAcChrominanceValues[162] = {
+        0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+        0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+        0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+        0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+        0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+        0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+        0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+        0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+        0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+        0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa };
+
+    // AAN DCT output scale factors
+    const float kAanScale[8] = { 1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+        1.0f, 0.785694958f, 0.541196100f, 0.275899379f };
+
+    struct HuffmanTable
+    {
+        unsigned short codes[256];
+        unsigned char sizes[256];
+
+        HuffmanTable(const unsigned char* bits, const unsigned char* values)
+        {
+            memset(codes, 0, sizeof(codes));
+            memset(sizes, 0, sizeof(sizes));
+
+            unsigned short code = 0;
+            int k = 0;
+            for (int length = 1; length <= 16; length++)
+            {
+                for (int i = 0; i < bits[length - 1]; i++, k++)
+                {
+                    codes[values[k]] = code++;
+                    sizes[values[k]] = (unsigned char)length;
+                }
+                code <<= 1;
+            }
+        }
+    };
+
+    struct JpegTables
+    {
+        HuffmanTable dcLuminance, acLuminance, dcChrominance, acChrominance;
+
+        JpegTables() :
+            dcLuminance(kDcLuminanceBits, kDcLuminanceValues),
+            acLuminance(kAcLuminanceBits, kAcLuminanceValues),
+            dcChrominance(kDcChrominanceBits, kDcChrominanceValues),
+            acChrominance(kAcChrominanceBits, kAcChrominanceValues)
+        {
+        }
+    };
+
+    struct JpegQuant
+    {
+        unsigned char luminance[64];    // natural order
+        unsigned char chrominance[64];
+        float luminanceScale[64];       // reciprocal divisors of the AAN output
+        float chrominanceScale[64];
+
+        JpegQuant(int quality)
+        {
+            quality = std::min(100, std::max(1, quality));
+            int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+            for (int i = 0; i < 64; i++)
+            {
+                luminance[i] = (unsigned char)std::min(255, std::max(1, (kLuminanceQuant[i] * scale + 50) / 100));
+                chrominance[i] = (unsigned char)std::min(255, std::max(1, (kChrominanceQuant[i] * scale + 50) / 100));
+
+                float aan = kAanScale[i / 8] * kAanScale[i % 8] * 8.0f;
+                luminanceScale[i] = 1.0f / (luminance[i] * aan);
+                chrominanceScale[i] = 1.0f / (chrominance[i] * aan);
+            }
+        }
+    };
+
+    // Entropy coded segment writer, most significant bit first with 0xFF stuffing
+    class JpegBitWriter
+    {
+    public:
+        JpegBitWriter(std::vector<unsigned char>& out) : m_out(out), m_bitBuffer(0), m_bitCount(0) {}
+
+        void writeBits(const uint32_t bits, const int count)
+        {
+            m_bitBuffer = (m_bitBuffer << count) | (bits & ((1u << count) - 1));
+            m_bitCount += count;
+            while (8 <= m_bitCount)
+            {
+                unsigned char c = (unsigned char)(m_bitBuffer >> (m_bitCount - 8));
+                m_out.push_back(c);
+                if (0xff == c)
+                    m_out.push_back(0x00);
+                m_bitCount -= 8;
+            }
+            m_bitBuffer &= (1u << m_bitCount) - 1;
+        }
+
+        // Pad the last byte with 1 bits
+        void flush()
+        {
+            if (0 < m_bitCount)
+                writeBits(0x7f, 8 - m_bitCount);
+        }
+
+    private:
+        std::vector<unsigned char>& m_out;
+        uint32_t m_bitBuffer;
+        int m_bitCount;
+    };
+
+    void forwardDct(float* data)
+    {
+        // Rows then columns, IJG floating point AAN algorithm
+        for (int pass = 0; pass < 2; pass++)
+        {
+            const int step = 0 == pass ? 1 : 8;
+            const int next = 0 == pass ? 8 : 1;
+            for (int line = 0; line < 8; line++)
+            {
+                float* d = data + line * next;
+
+                float tmp0 = d[0 * step] + d[7 * step];
+                float tmp7 = d[0 * step] - d[7 * step];
+                float tmp1 = d[1 * step] + d[6 * step];
+                float tmp6 = d[1 * step] - d[6 * step];
+                float tmp2 = d[2 * step] + d[5 * step];
+                float tmp5 = d[2 * step] - d[5 * step];
+                float tmp3 = d[3 * step] + d[4 * step];
+                float tmp4 = d[3 * step] - d[4 * step];
+
+                float tmp10 = tmp0 + tmp3;
+                float tmp13 = tmp0 - tmp3;
+                float tmp11 = tmp1 + tmp2;
+                float tmp12 = tmp1 - tmp2;
+
+                d[0 * step] = tmp10 + tmp11;
+                d[4 * step] = tmp10 - tmp11;
+
+                float z1 = (tmp12 + tmp13) * 0.707106781f;
+                d[2 * step] = tmp13 + z1;
+                d[6 * step] = tmp13 - z1;
+
+                tmp10 = tmp4 + tmp5;
+                tmp11 = tmp5 + tmp6;
+                tmp12 = tmp6 + tmp7;
+
+                float z5 = (tmp10 - tmp12) * 0.382683433f;
+                float z2 = 0.541196100f * tmp10 + z5;
+                float z4 = 1.306562965f * tmp12 + z5;
+                float z3 = tmp11 * 0.707106781f;
+
+                float z11 = tmp7 + z3;
+                float z13 = tmp7 - z3;
+
+                d[5 * step] = z13 + z2;
+                d[3 * step] = z13 - z2;
+                d[1 * step] = z11 + z4;
+                d[7 * step] = z11 - z4;
+            }
+        }
+    }
+
+    void writeCoefficient(JpegBitWriter& writer, const HuffmanTable& table, const int runSize, int value, const int category)
+    {
+        writer.writeBits(table.codes[runSize], table.sizes[runSize]);
+        if (0 < category)
+        {
+            if (value < 0)
+                value -= 1;
+            writer.writeBits((uint32_t)value, category);
+        }
+    }
+
+    int getCategory(int value)
+    {
+        value = abs(value);
+        int category = 0;
+        while (value)
+        {
+            category++;
+            value >>= 1;
+        }
+        return category;
+    }
+
+    // Transform, quantize and entropy code one 8x8 block. Returns the DC value.
+    int encodeBlock(JpegBitWriter& writer, float* block, const float* scale, const HuffmanTable& dcTable, const HuffmanTable& acTable, const int previousDc)
+    {
+        forwardDct(block);
+
+        int quantized[64];
+        for (int i = 0; i < 64; i++)
+        {
+            int natural = kZigZag[i];
+            quantized[i] = (int)lroundf(block[natural] * scale[natural]);
+        }
+
+        int diff = quantized[0] - previousDc;
+        int category = getCategory(diff);
+        writeCoefficient(writer, dcTable, category, diff, category);
+
+        int run = 0;
+        for (int i = 1; i < 64; i++)
+        {
+            if (0 == quantized[i])
+            {
+                run++;
+                continue;
+            }
+
+            while (16 <= run)
+            {
+                writeCoefficient(writer, acTable, 0xf0, 0, 0); // ZRL
+                run -= 16;
+            }
+
+            category = getCategory(quantized[i]);
+            writeCoefficient(writer, acTable, (run << 4) | category, quantized[i], category);
+            run = 0;
+        }
+
+        if (0 < run)
+            writeCoefficient(writer, acTable, 0x00, 0, 0); // EOB
+
+        return quantized[0];
+    }
+
+    // Encode rows [mcuRow0, mcuRow1) of 16x16 MCUs. Each row is one restart interval.
+    void encodeMcuRows(const unsigned char* rgba, const int width, const int height, const JpegQuant& quant, const JpegTables& tables,
+        const int mcuRow0, const int mcuRow1, const int mcuRowCount, std::vector<unsigned char>& out)
+    {
+        const int mcuColumnCount = (width + 15) / 16;
+
+        JpegBitWriter writer(out);
+
+        float y[4][64], cb[64], cr[64];
+        for (int mcuRow = mcuRow0; mcuRow < mcuRow1; mcuRow++)
+        {
+            int dcY = 0, dcCb = 0, dcCr = 0;
+
+            for (int mcuColumn = 0; mcuColumn < mcuColumnCount; mcuColumn++)
+            {
+                memset(cb, 0, sizeof(cb));
+                memset(cr, 0, sizeof(cr));
+
+                // Colour conversion with edge replication, chroma averaged over 2x2 pixels
+                for (int py = 0; py < 16; py++)
+                {
+                    int sy = std::min(height - 1, mcuRow * 16 + py);
+                    const unsigned char* row = rgba + (size_t)sy * width * 4;
+
+                    for (int px = 0; px < 16; px++)
+                    {
+                        int sx = std::min(width - 1, mcuColumn * 16 + px);
+                        const unsigned char* p = row + sx * 4;
+                        float r = p[0], g = p[1], b = p[2];
+
+                        int block = (py / 8) * 2 + px / 8;
+                        y[block][(py % 8) * 8 + px % 8] = 0.299f * r + 0.587f * g + 0.114f * b - 128.0f;
+
+                        int c = (py / 2) * 8 + px / 2;
+                        cb[c] += 0.25f * (-0.168736f * r - 0.331264f * g + 0.5f * b);
+                        cr[c] += 0.25f * (0.5f * r - 0.418688f * g - 0.081312f * b);
+                    }
+                }
+
+                for (int block = 0; block < 4; block++)
+                    dcY = encodeBlock(writer, y[block], quant.luminanceScale, tables.dcLuminance, tables.acLuminance, dcY);
+                dcCb = encodeBlock(writer, cb, quant.chrominanceScale, tables.dcChrominance, tables.acChrominance, dcCb);
+                dcCr = encodeBlock(writer, cr, quant.chrominanceScale, tables.dcChrominance, tables.acChrominance, dcCr);
+            }
+
+            writer.flush();
+            if (mcuRow < mcuRowCount - 1)
+            {
+                out.push_back(0xff);
+                out.push_back((unsigned char)(0xd0 + mcuRow % 8)); // RSTn
+            }
+        }
+    }
+
+    void writeMarker(std::vector<unsigned char>& out, const unsigned char marker, const size_t length)
+    {
+        out.push_back(0xff);
+        out.push_back(marker);
+        out.push_back((unsigned char)((length + 2) >> 8));
+        out.push_back((unsigned char)(length + 2));
+    }
+
+    void writeHuffmanTable(std::vector<unsigned char>& out, const unsigned char tableClassAndId, const unsigned char* bits, const unsigned char* values)
+    {
+        int valueCount = 0;
+        for (int i = 0; i < 16; i++)
+            valueCount += bits[i];
+
+        out.push_back(tableClassAndId);
+        out.insert(out.end(), bits, bits + 16);
+        out.insert(out.end(), values, values + valueCount);
+    }
+}
+
+bool encodeJpeg(const unsigned char* rgba, const int width, const int height, const int quality, std::vector<unsigned char>& jpeg)
+{
+    if (NULL == rgba || 0 >= width || 0 >= height || 0xffff < width || 0xffff < height)
+        return false;
+
+    static const JpegTables tables;
+    const JpegQuant quant(quality);
+
+    const int mcuColumnCount = (width + 15) / 16;
+    const int mcuRowCount = (height + 15) / 16;
+
+    // Bands of MCU rows are encoded in parallel, restart markers make them independent
+    const int bandCount = getBandCount(mcuRowCount / 4);
+    const int bandRows = (mcuRowCount + bandCount - 1) / bandCount;
+    std::vector<std::vector<unsigned char>> bands(bandCount);
+
+    runBands(bandCount, [&](int band) {
+        const int row0 = band * bandRows;
+        const int row1 = std::min(mcuRowCount, row0 + bandRows);
+        if (row0 < row1)
+            encodeMcuRows(rgba, width, height, quant, tables, row0, row1, mcuRowCount, bands[band]);
+    });
+
+    jpeg.clear();
+
+    // SOI
+    jpeg.push_back(0xff);
+    jpeg.push_back(0xd8);
+
+    // APP0 JFIF
+    const unsigned char jfif[14] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+    writeMarker(jpeg, 0xe0, sizeof(jfif));
+    jpeg.insert(jpeg.end(), jfif, jfif + sizeof(jfif));
+
+    // DQT, tables stored in zigzag order
+    writeMarker(jpeg, 0xdb, 2 * 65);
+    jpeg.push_back(0x00);
+    for (int i = 0; i < 64; i++)
+        jpeg.push_back(quant.luminance[kZigZag[i]]);
+    jpeg.push_back(0x01);
+    for (int i = 0; i < 64; i++)
+        jpeg.push_back(quant.chrominance[kZigZag[i]]);
+
+    // SOF0: 3 components, luminance sampled 2x2
+    writeMarker(jpeg, 0xc0, 15);
+    jpeg.push_back(8);
+    jpeg.push_back((unsigned char)(height >> 8));
+    jpeg.push_back((unsigned char)height);
+    jpeg.push_back((unsigned char)(width >> 8));
+    jpeg.push_back((unsigned char)width);
+    jpeg.push_back(3);
+    const unsigned char components[9] = { 1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1 };
+    jpeg.insert(jpeg.end(), components, components + 9);
+
+    // DHT
+    writeMarker(jpeg, 0xc4, 4 * 17 + 12 + 162 + 12 + 162);
+    writeHuffmanTable(jpeg, 0x00, kDcLuminanceBits, kDcLuminanceValues);
+    writeHuffmanTable(jpeg, 0x10, kAcLuminanceBits, kAcLuminanceValues);
+    writeHuffmanTable(jpeg, 0x01, kDcChrominanceBits, kDcChrominanceValues);
+    writeHuffmanTable(jpeg, 0x11, kAcChrominanceBits, kAcChrominanceValues);
+
+    // DRI: one restart interval per MCU row
+    writeMarker(jpeg, 0xdd, 2);
+    jpeg.push_back((unsigned char)(mcuColumnCount >> 8));
+    jpeg.push_back((unsigned char)mcuColumnCount);
+
+    // SOS
+    writeMarker(jpeg, 0xda, 10);
+    jpeg.push_back(3);
+    const unsigned char scanComponents[6] = { 1, 0x00, 2, 0x11, 3, 0x11 };
+    jpeg.insert(jpeg.end(), scanComponents, scanComponents + 6);
+    jpeg.push_back(0);
+    jpeg.push_back(63);
+    jpeg.push_back(0);
+
+    for (int band = 0; band < bandCount; band++)
+        jpeg.insert(jpeg.end(), bands[band].begin(), bands[band].end());
+
+    // EOI
+    jpeg.push_back(0xff);
+    jpeg.push_back(0xd9);
+
+    return true;
+}
+
+bool encodeFrame(const unsigned char* rgba, const int width, const int height, const FrameFormat format, const int quality, std::vector<unsigned char>& out)
+{
+    switch (format)
+    {
+    case FRAME_FORMAT_JPEG: return encodeJpeg(rgba, width, height, quality, out);
+    case FRAME_FORMAT_PNG_FAST: return encodePng(rgba, width, height, out, true);
+    default: return encodePng(rgba, width, height, out, false);
+    }
+}
+
+const char* getFrameContentType(const FrameFormat format)
+{
+    return FRAME_FORMAT_JPEG == format ? "image/jpeg" : "image/png";
+}
+
+namespace
+{
+    void writeUint16LE(std::vector<unsigned char>& out, const unsigned int value)
+    {
+        out.push_back((unsigned char)value);
+        out.push_back((unsigned char)(value >> 8));
+    }
+
+    void writeUint32LE(std::vector<unsigned char>& out, const uint32_t value)
+    {
+        writeUint16LE(out, value & 0xffff);
+        writeUint16LE(out, value >> 16);
+    }
+
+    bool isTileChanged(const unsigned char* rgba, const unsigned char* previous, const int width, const int x0, const int y0, const int tileWidth, const int tileHeight)
+    {
+        for (int y = y0; y < y0 + tileHeight; y++)
+        {
+            size_t offset = ((size_t)y * width + x0) * 4;
+            if (0 != memcmp(rgba + offset, previous + offset, (size_t)tileWidth * 4))
+                return true;
+        }
+        return false;
+    }
+}
+
+bool encodeFrameTiles(const unsigned char* rgba, const unsigned char* previous, const int width, const int height, const int tileSize,
+    const bool lossless, const int quality, const unsigned int frameId, std::vector<bool>& tileLossless, std::vector<unsigned char>& payload)
+{
+    if (NULL == rgba || 0 >= width || 0 >= height || 0xffff < width || 0xffff < height || 0 >= tileSize)
+        return false;
+
+    const int columnCount = (width + tileSize - 1) / tileSize;
+    const int rowCount = (height + tileSize - 1) / tileSize;
+    const int tileCount = columnCount * rowCount;
+
+    if (NULL == previous || (int)tileLossless.size() != tileCount)
+        tileLossless.assign(tileCount, false);
+
+    // Pick the tiles to send: changed ones, and lossy ones once a lossless frame is asked for
+    std::vector<int> tiles;
+    for (int tile = 0; tile < tileCount; tile++)
+    {
+        int x0 = (tile % columnCount) * tileSize;
+        int y0 = (tile / columnCount) * tileSize;
+        int tileWidth = std::min(tileSize, width - x0);
+        int tileHeight = std::min(tileSize, height - y0);
+
+        if (NULL == previous || isTileChanged(rgba, previous, width, x0, y0, tileWidth, tileHeight) || (lossless && !tileLossless[tile]))
+            tiles.push_back(tile);
+    }
+
+    const FrameFormat format = lossless ? FRAME_FORMAT_PNG : FRAME_FORMAT_JPEG;
+    std::vector<std::vector<unsigned char>> encoded(tiles.size());
+
+    // Refinement passes change a few tiles only, they are encoded on the caller thread
+    const size_t pixelCount = tiles.size() * tileSize * tileSize;
+    const int bandCount = (kMinParallelPixels <= pixelCount) ? getBandCount((int)tiles.size()) : 1;
+    runBands(bandCount, [&](int band) {
+        std::vector<unsigned char> pixels;
+        for (size_t i = band; i < tiles.size(); i += bandCount)
+        {
+            int x0 = (tiles[i] % columnCount) * tileSize;
+            int y0 = (tiles[i] / columnCount) * tileSize;
+            int tileWidth = std::min(tileSize, width - x0);
+            int tileHeight = std::min(tileSize, height - y0);
+
+            pixels.resize((size_t)tileWidth * tileHeight * 4);
+            for (int y = 0; y < tileHeight; y++)
+                memcpy(&pixels[(size_t)y * tileWidth * 4], rgba + ((size_t)(y0 + y) * width + x0) * 4, (size_t)tileWidth * 4);
+
+            encodeFrame(&pixels[0], tileWidth, tileHeight, format, quality, encoded[i]);
+        }
+    });
+
+    payload.clear();
+    writeUint32LE(payload, frameId);
+    writeUint16LE(payload, width);
+    writeUint16LE(payload, height);
+    writeUint16LE(payload, tileSize);
+    writeUint16LE(payload, 0);
+    writeUint32LE(payload, (uint32_t)tiles.size());
+
+    for (size_t i = 0; i < tiles.size(); i++)
+    {
+        writeUint16LE(payload, tiles[i] % columnCount);
+        writeUint16LE(payload, tiles[i] / columnCount);
+        payload.push_back((unsigned char)format);
+        payload.push_back(0);
+        payload.push_back(0);
+        payload.push_back(0);
+        writeUint32LE(payload, (uint32_t)encoded[i].size());
+        payload.insert(payload.end(), encoded[i].begin(), encoded[i].end());
+
+        tileLossless[tiles[i]] = lossless;
+    }
+
+    return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+
+enum FrameFormat
+{
+    FRAME_FORMAT_AUTO = -1,     // Lossy while a frame is refined, lossless once converged
+    FRAME_FORMAT_PNG = 0,       // Lossless, adaptive scanline filters
+    FRAME_FORMAT_PNG_FAST = 1,  // Lossless, cheaper filtering and match search
+    FRAME_FORMAT_JPEG = 2       // Lossy, driven by a quality setting
+};
+
+/**
+ * Encode an 8 bit RGBA frame as a PNG image in memory.
+ * The frame is split in horizontal bands compressed in parallel.
+ * @param[in] rgba Pixels, 4 bytes per pixel, rows stored top-down.
+ * @param[in] width Frame width.
+ * @param[in] height Frame height.
+ * @param[out] png Encoded PNG stream.
+ * @param[in] fast Trade compression ratio for encoding speed.
+ * @return True if success, otherwise False.
+ */
+bool encodePng(const unsigned char* rgba, const int width, const int height, std::vector<unsigned char>& png, const bool fast = false);
+
+/**
+ * Encode an 8 bit RGBA frame as a baseline 4:2:0 JPEG image in memory.
+ * Alpha is dropped. Rows of MCUs are separated by restart markers so that
+ * bands of the frame are encoded in parallel.
+ * @param[in] rgba Pixels, 4 bytes per pixel, rows stored top-down.
+ * @param[in] width Frame width.
+ * @param[in] height Frame height.
+ * @param[in] quality 1 (smallest) to 100 (best).
+ * @param[out] jpeg Encoded JPEG stream.
+ * @return True if success, otherwise False.
+ */
+bool encodeJpeg(const unsigned char* rgba, const int width, const int height, const int quality, std::vector<unsigned char>& jpeg);
+
+/**
+ * Encode a frame with the given format.
+ * @param[in] quality Used by lossy formats only.
+ * @return True if success, otherwise False.
+ */
+bool encodeFrame(const unsigned char* rgba, const int width, const int height, const FrameFormat format, const int quality, std::vector<unsigned char>& out);
+
+/**
+ * HTTP content type matching a frame format.
+ */
+const char* getFrameContentType(const FrameFormat format);
+
+/**
+ * Encode the tiles of a frame which differ from a previous frame into one binary payload.
+ * Layout, little-endian: uint32 frameId, uint16 width, uint16 height, uint16 tileSize,
+ * uint16 reserved, uint32 tileCount, then for each tile: uint16 column, uint16 row,
+ * uint8 FrameFormat, 3 reserved bytes, uint32 byte size and the encoded tile.
+ * @param[in] rgba Current frame pixels, rows stored top-down.
+ * @param[in] previous Pixels of the frame the client holds, NULL to send every tile.
+ * @param[in] tileSize Tile width and height in pixels.
+ * @param[in] lossless Send PNG tiles, lossy tiles still held by the client are sent again.
+ * @param[in] quality JPEG quality of lossy tiles.
+ * @param[in] frameId Identifier the client acknowledges with its next request.
+ * @param[in,out] tileLossless Per tile, whether the client holds a lossless version.
+ * @param[out] payload Encoded tiles.
+ * @return True if success, otherwise False.
+ */
+bool encodeFrameTiles(const unsigned char* rgba, const unsigned char* previous, const int width, const int height, const int tileSize,
+    const bool lossless, const int quality, const unsigned int frameId, std::vector<bool>& tileLossless, std::vector<unsigned char>& payload);
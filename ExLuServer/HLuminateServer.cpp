@@ -1,5 +1,11 @@
 #include "HLuminateServer.h"
+#include "FrameDenoiser.h"
 #include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <memory>
 #include <REDObject.h>
 #include <REDFactory.h>
 #include <REDIResourceManager.h>
@@ -11,6 +17,7 @@
 #include <REDIMaterialController.h>
 #include <REDIMaterialControllerProperty.h>
 #include "hoops_license.h"
+#include "utilities.h"
 
 #define RC_CHECK(rc)                                                               \
     {                                                                              \
@@ -69,8 +76,260 @@ HWND CreateWndow(const int width, const int height)
 }
 #endif
 
+HLuminateServer::HLuminateServer() :
+    m_bStopThread(false),
+    m_renderDemand(0),
+    m_threadBudget(-1),
+    m_bStopProgress(false)
+{
+    m_luminateThread = std::thread(&HLuminateServer::luminateThreadLoop, this);
+}
+
+HLuminateServer::~HLuminateServer()
+{
+    stopLuminateThread();
+}
+
+void HLuminateServer::luminateThreadLoop()
+{
+    while (true)
+    {
+        // Sessions are only touched from this thread, no lock is needed to inspect them.
+        // Without threads, frames wait for the host to hand out a budget again
+        bool bPaused = 0 == m_threadBudget;
+        bool bIdle = bPaused || !hasPendingFrames();
+        bool bInteractive = !bPaused && bIdle && hasInteractiveSessions();
+
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_taskMutex);
+
+            // Interactive sessions are polled until their camera is idle, then go back to full quality
+            if (bInteractive)
+                m_taskCondition.wait_for(lock, std::chrono::milliseconds(20), [this]() { return m_bStopThread || !m_tasks.empty(); });
+            else if (bIdle)
+                m_taskCondition.wait(lock, [this]() { return m_bStopThread || !m_tasks.empty(); });
+
+            if (m_bStopThread && m_tasks.empty())
+                return;
+
+            if (!m_tasks.empty())
+            {
+                task = m_tasks.front();
+                m_tasks.pop_front();
+            }
+        }
+
+        // Requests take precedence, rendering goes on between them
+        if (task)
+            task();
+        else if (!bPaused)
+            drawPendingFrames();
+
+        // Published for GetRenderDemand, which must not wait behind the tasks
+        int demand = 0;
+        for (auto it = m_mHLuminateSession.begin(); it != m_mHLuminateSession.end(); ++it)
+            demand += getSessionWeight(it->second);
+        m_renderDemand = demand;
+    }
+}
+
+bool HLuminateServer::hasPendingFrames()
+{
+    for (auto it = m_mHLuminateSession.begin(); it != m_mHLuminateSession.end(); ++it)
+    {
+        if (it->second.bInterrupted || (it->second.bRendering && it->second.pHCLuminateBridge->isDrawRequired()))
+            return true;
+    }
+    return false;
+}
+
+bool HLuminateServer::hasInteractiveSessions()
+{
+    for (auto it = m_mHLuminateSession.begin(); it != m_mHLuminateSession.end(); ++it)
+    {
+        if (it->second.bRendering && it->second.pHCLuminateBridge->isInteractive())
+            return true;
+    }
+    return false;
+}
+
+int HLuminateServer::getSessionWeight(const LuminateSession& lumSession)
+{
+    if (!lumSession.bRendering || !lumSession.pHCLuminateBridge->isDrawRequired())
+        return 0;
+
+    // A camera that just moved needs its first passes quickly, a nearly converged frame can wait
+    FrameStatistics statistics = lumSession.pHCLuminateBridge->getFrameStatistics();
+    if (lumSession.pHCLuminateBridge->isInteractive() || statistics.renderingProgress < 0.1f)
+        return 4;
+    if (statistics.renderingProgress < 0.9f)
+        return 2;
+    return 1;
+}
+
+void HLuminateServer::commitFrameState(const std::string& drawnSessionId)
+{
+    // New frames of the rendering sessions, of the interrupted ones and of the session about to be drawn
+    std::vector<HoopsLuminateBridgeEx*> newFrames;
+    for (auto it = m_mHLuminateSession.begin(); it != m_mHLuminateSession.end(); ++it)
+    {
+        if (!it->second.bRendering && !it->second.bInterrupted && it->first != drawnSessionId)
+            continue;
+        it->second.bInterrupted = false;
+
+        if (it->second.pHCLuminateBridge->prepareFrame())
+            newFrames.push_back(it->second.pHCLuminateBridge);
+    }
+    if (newFrames.empty())
+        return;
+
+    // The transaction is shared by every window: stop the ones tracing before it is closed,
+    // their frames start again under the new state
+    for (auto it = m_mHLuminateSession.begin(); it != m_mHLuminateSession.end(); ++it)
+    {
+        if (it->second.pHCLuminateBridge->interruptFrame())
+            newFrames.push_back(it->second.pHCLuminateBridge);
+    }
+
+    RED::Object* resmgr = RED::Factory::CreateInstance(CID_REDResourceManager);
+    RED::IResourceManager* iresmgr = resmgr->As<RED::IResourceManager>();
+
+    RC_CHECK(iresmgr->EndState());
+    iresmgr->BeginState();
+
+    for (HoopsLuminateBridgeEx* bridge : newFrames)
+        bridge->beginFrame();
+}
+
+void HLuminateServer::drawPendingFrames()
+{
+    commitFrameState();
+
+    // Refinement steps per session follow its weight so that every session progresses
+    for (auto it = m_mHLuminateSession.begin(); it != m_mHLuminateSession.end(); ++it)
+    {
+        int weight = getSessionWeight(it->second);
+        for (int step = 0; step < weight && it->second.pHCLuminateBridge->isDrawRequired(); step++)
+        {
+            it->second.pHCLuminateBridge->draw();
+            publishFrameProgress(it->first, it->second.pHCLuminateBridge->getFrameStatistics());
+        }
+    }
+}
+
+void HLuminateServer::SetThreadBudget(int threadCount)
+{
+    // Idle processes get no thread, their next frame starts once the host rebalances
+    postToLuminateThread([this, threadCount]() {
+        m_threadBudget = std::max(0, threadCount);
+        if (0 < m_threadBudget)
+            setRayMaxThreadCount(m_threadBudget);
+    });
+}
+
+int HLuminateServer::GetRenderDemand()
+{
+    return m_renderDemand;
+}
+
+void HLuminateServer::publishFrameProgress(const std::string& sessionId, const FrameStatistics& statistics)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_progressMutex);
+        FrameProgress& progress = m_mFrameProgress[sessionId];
+
+        // draw() returns every few milliseconds, the streams only hear about new frames, passes and completion
+        if (0 < progress.passId &&
+            statistics.elapsedMilliseconds >= progress.statistics.elapsedMilliseconds &&
+            statistics.tracedPasses == progress.statistics.tracedPasses &&
+            statistics.currentPass == progress.statistics.currentPass &&
+            statistics.renderingIsDone == progress.statistics.renderingIsDone)
+            return;
+
+        progress.passId++;
+        progress.statistics = statistics;
+    }
+    m_progressCondition.notify_all();
+}
+
+void HLuminateServer::stopLuminateThread()
+{
+    if (isLuminateThread())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_taskMutex);
+        m_bStopThread = true;
+    }
+    m_taskCondition.notify_one();
+    m_luminateThread.join();
+}
+
+bool HLuminateServer::isLuminateThread() const
+{
+    // Once the thread is stopped, calls run on the caller
+    if (!m_luminateThread.joinable())
+        return true;
+
+    return std::this_thread::get_id() == m_luminateThread.get_id();
+}
+
+template <typename T>
+T HLuminateServer::runOnLuminateThread(std::function<T()> task)
+{
+    if (isLuminateThread())
+        return task();
+
+    // packaged_task is move only, share it to fit into std::function
+    std::shared_ptr<std::packaged_task<T()>> pTask = std::make_shared<std::packaged_task<T()>>(task);
+    std::future<T> result = pTask->get_future();
+    {
+        std::lock_guard<std::mutex> lock(m_taskMutex);
+        m_tasks.push_back([pTask]() { (*pTask)(); });
+    }
+    m_taskCondition.notify_one();
+
+    return result.get();
+}
+
+void HLuminateServer::postToLuminateThread(std::function<void()> task)
+{
+    if (isLuminateThread())
+    {
+        task();
+        return;
+    }
+
+    // Unlike runOnLuminateThread, the caller does not wait for the task
+    {
+        std::lock_guard<std::mutex> lock(m_taskMutex);
+        m_tasks.push_back(task);
+    }
+    m_taskCondition.notify_one();
+}
+
+void HLuminateServer::discardPrebuiltScene(const std::string& sessionId)
+{
+    std::map<std::string, PrebuiltScene>::iterator it = m_mPrebuiltScene.find(sessionId);
+    if (it == m_mPrebuiltScene.end())
+        return;
+
+    if (nullptr != it->second.sceneInfo)
+        destroyScene(*it->second.sceneInfo);
+
+    m_mPrebuiltScene.erase(it);
+}
+
 bool HLuminateServer::Terminate()
 {
+    if (!isLuminateThread())
+    {
+        bool ret = runOnLuminateThread<bool>([&]() { return Terminate(); });
+        stopLuminateThread();
+        return ret;
+    }
+
     //////////////////////////////////////////
     // Get the resource manager singleton.
     //////////////////////////////////////////
@@ -82,12 +341,21 @@ bool HLuminateServer::Terminate()
      // Stop all tracing threads.
      //////////////////////////////////////////
 
-    for (auto it = m_mHLuminateSession.begin(); it != m_mHLuminateSession.end(); ++it)
+    interruptFrames();
+    std::map<std::string, LuminateSession>().swap(m_mHLuminateSession);
+
+    while (!m_mPrebuiltScene.empty())
+        discardPrebuiltScene(m_mPrebuiltScene.begin()->first);
+
+    m_mLibraryMaterial.clear();
+
+    // Close the event streams
     {
-        LuminateSession lumSession = it->second;
-        stopFrameTracing(lumSession.pHCLuminateBridge);
+        std::lock_guard<std::mutex> lock(m_progressMutex);
+        m_bStopProgress = true;
+        m_mFrameProgress.clear();
     }
-    std::map<std::string, LuminateSession>().swap(m_mHLuminateSession);
+    m_progressCondition.notify_all();
 
     //////////////////////////////////////////
     // Destroy the resource manager.
@@ -102,6 +370,9 @@ bool HLuminateServer::PrepareRendering(std::string sessionId,
     double* target, double* up, double* position, int projection, double cameraW, double cameraH, 
     int width, int height)
 {
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return PrepareRendering(sessionId, target, up, position, projection, cameraW, cameraH, width, height); });
+
     LuminateSession lumSession;
 
     if (0 == m_mHLuminateSession.count(sessionId))
@@ -122,54 +393,269 @@ bool HLuminateServer::PrepareRendering(std::string sessionId,
     {
         lumSession = m_mHLuminateSession[sessionId];
     }
+    commitFrameState(sessionId);
     lumSession.pHCLuminateBridge->draw();
     
     return true;
 }
 
+void HLuminateServer::PrebuildScene(std::string sessionId, ExSceneDataPtr sceneData)
+{
+    if (nullptr == sceneData)
+        return;
+
+    // Queued behind pending requests, the caller goes on with the SC export meanwhile
+    postToLuminateThread([this, sessionId, sceneData]() {
+        discardPrebuiltScene(sessionId);
+
+        // The first session may not have a Luminate window yet
+        if (RED_OK != initializeLuminate(HOOPS_LICENSE))
+            return;
+
+        PrebuiltScene prebuilt;
+        prebuilt.sceneData = sceneData;
+        prebuilt.sceneInfo = buildLuminateScene(*sceneData);
+        m_mPrebuiltScene[sessionId] = prebuilt;
+    });
+}
+
 bool HLuminateServer::StartRendering(std::string sessionId,
     double* target, double* up, double* position, int projection, double cameraW, double cameraH,
-    int width, int height, A3DAsmModelFile* pModelFile, A3DEntity* pPrcIdMap)
+    int width, int height, ExSceneDataPtr sceneData)
 {
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return StartRendering(sessionId, target, up, position, projection, cameraW, cameraH, width, height, sceneData); });
+
     if (m_mHLuminateSession.count(sessionId))
     {
         LuminateSession lumSession = m_mHLuminateSession[sessionId];
 
         CameraInfo cameraInfo = lumSession.pHCLuminateBridge->creteCameraInfo(target, up, position, projection, cameraW, cameraH);
 
-        lumSession.pHCLuminateBridge->setModelFile(pModelFile, pPrcIdMap);
+        lumSession.pHCLuminateBridge->setSceneData(sceneData);
+
+        // Hand over the scene built after upload, unless another model was uploaded since
+        // or the bridge still holds the scene of this one
+        if (!lumSession.pHCLuminateBridge->isConvertedSceneCurrent() &&
+            m_mPrebuiltScene.count(sessionId) && m_mPrebuiltScene[sessionId].sceneData == sceneData)
+        {
+            lumSession.pHCLuminateBridge->setPrebuiltScene(m_mPrebuiltScene[sessionId].sceneInfo);
+            m_mPrebuiltScene.erase(sessionId);
+        }
+        else
+        {
+            discardPrebuiltScene(sessionId);
+        }
 
         lumSession.pHCLuminateBridge->syncScene(width, height, cameraInfo);
 
+        m_mHLuminateSession[sessionId].bRendering = true;
+
         return true;
     }
     return false;
 }
 
-std::vector<float> HLuminateServer::Draw(std::string sessionId, char* filePath)
+std::vector<float> HLuminateServer::Draw(std::string sessionId)
 {
+    if (!isLuminateThread())
+        return runOnLuminateThread<std::vector<float>>([&]() { return Draw(sessionId); });
+
     std::vector<float> floatArr;
     
     if (m_mHLuminateSession.count(sessionId))
     {
         LuminateSession lumSession = m_mHLuminateSession[sessionId];
 
-        for (int i = 0; i < 10; i++)
-            lumSession.pHCLuminateBridge->draw();
-
+        // The frame is refined by the Luminate thread, only report its current state
         FrameStatistics statistics = lumSession.pHCLuminateBridge->getFrameStatistics();
 
         floatArr.push_back(statistics.renderingIsDone);
         floatArr.push_back(statistics.renderingProgress);
         floatArr.push_back(statistics.remainingTimeMilliseconds);
-
-        lumSession.pHCLuminateBridge->saveImg(filePath);
     }
     return floatArr;
 }
 
+bool HLuminateServer::WaitFrameProgress(std::string sessionId, unsigned int& passId, FrameStatistics& statistics, int timeoutMilliseconds)
+{
+    // Runs on the caller thread, the Luminate thread only publishes
+    std::unique_lock<std::mutex> lock(m_progressMutex);
+
+    // No pass yet, wait for the first one
+    if (0 == m_mFrameProgress.count(sessionId))
+        m_mFrameProgress[sessionId] = FrameProgress();
+
+    m_progressCondition.wait_for(lock, std::chrono::milliseconds(timeoutMilliseconds), [&]() {
+        return m_bStopProgress || 0 == m_mFrameProgress.count(sessionId) || passId != m_mFrameProgress[sessionId].passId;
+    });
+
+    // The session was cleared
+    if (m_bStopProgress || 0 == m_mFrameProgress.count(sessionId))
+        return false;
+
+    // passId is left unchanged on timeout
+    const FrameProgress& progress = m_mFrameProgress[sessionId];
+    if (passId != progress.passId)
+    {
+        passId = progress.passId;
+        statistics = progress.statistics;
+    }
+    return true;
+}
+
+bool HLuminateServer::readFrame(std::string sessionId, std::vector<unsigned char>& rgba, int& width, int& height, bool& bConverged, float& denoiseStrength)
+{
+    bool bRead = runOnLuminateThread<bool>([&]() {
+        if (0 == m_mHLuminateSession.count(sessionId))
+            return false;
+
+        HoopsLuminateBridgeEx* bridge = m_mHLuminateSession[sessionId].pHCLuminateBridge;
+        bConverged = !bridge->isDrawRequired();
+
+        // Noise fades out as passes accumulate, a frame stopped by its budget may still be noisy
+        FrameStatistics statistics = bridge->getFrameStatistics();
+        denoiseStrength = 0.f;
+        if (m_mHLuminateSession[sessionId].bDenoise && (!bConverged || statistics.budgetIsReached))
+            denoiseStrength = std::max(0.f, 1.f - 1.25f * statistics.renderingProgress);
+
+        return RED_OK == bridge->getRenderImagePixels(rgba, width, height);
+    });
+
+    // Filter on the caller thread so that rendering goes on meanwhile
+    if (bRead && 0.f < denoiseStrength)
+        denoiseFrame(&rgba[0], width, height, 3, denoiseStrength);
+
+    return bRead;
+}
+
+bool HLuminateServer::GetFrame(std::string sessionId, FrameFormat& format, int quality, std::vector<unsigned char>& image)
+{
+    std::vector<unsigned char> rgba;
+    int width = 0, height = 0;
+    bool bConverged = false;
+    float denoiseStrength = 0.f;
+
+    if (!readFrame(sessionId, rgba, width, height, bConverged, denoiseStrength))
+        return false;
+
+    if (FRAME_FORMAT_AUTO == format)
+        format = bConverged ? FRAME_FORMAT_PNG : FRAME_FORMAT_JPEG;
+
+    // Encode on the caller thread so that rendering goes on meanwhile
+    return encodeFrame(&rgba[0], width, height, format, quality, image);
+}
+
+bool HLuminateServer::Render(std::string sessionId, int timeBudgetMilliseconds, int passBudget,
+    FrameFormat& format, int quality, std::vector<unsigned char>& image, FrameStatistics& statistics)
+{
+    // Restart the frame with the budget, passes published before it are skipped.
+    // A single Render at a time per session, the budget is not shared
+    unsigned int passId = 0;
+    bool bStarted = runOnLuminateThread<bool>([&]() {
+        if (0 == m_mHLuminateSession.count(sessionId) || !m_mHLuminateSession[sessionId].bRendering ||
+            m_mHLuminateSession[sessionId].bBudgetRender)
+            return false;
+        m_mHLuminateSession[sessionId].bBudgetRender = true;
+
+        HoopsLuminateBridgeEx* bridge = m_mHLuminateSession[sessionId].pHCLuminateBridge;
+        bridge->setFrameBudget(timeBudgetMilliseconds, passBudget);
+        bridge->resetFrame();
+
+        std::lock_guard<std::mutex> lock(m_progressMutex);
+        passId = m_mFrameProgress[sessionId].passId;
+        return true;
+    });
+    if (!bStarted)
+        return false;
+
+    // Wait on the caller thread, other sessions keep rendering
+    statistics = FrameStatistics();
+    bool bRendering = true;
+    while (bRendering && !statistics.renderingIsDone)
+    {
+        unsigned int lastPassId = passId;
+        if (!WaitFrameProgress(sessionId, passId, statistics, 1000))
+        {
+            bRendering = false;
+            break;
+        }
+
+        // No pass for a while, make sure the session is still rendering
+        if (lastPassId == passId)
+        {
+            bRendering = runOnLuminateThread<bool>([&]() {
+                return 0 != m_mHLuminateSession.count(sessionId) && m_mHLuminateSession[sessionId].bRendering;
+            });
+        }
+    }
+
+    bool bFrame = bRendering && GetFrame(sessionId, format, quality, image);
+
+    // The budget image is not the final one: the frame goes on refining from there until converged
+    runOnLuminateThread<bool>([&]() {
+        if (0 == m_mHLuminateSession.count(sessionId))
+            return false;
+
+        m_mHLuminateSession[sessionId].bBudgetRender = false;
+        m_mHLuminateSession[sessionId].pHCLuminateBridge->setFrameBudget(0, 0);
+        return true;
+    });
+
+    return bFrame;
+}
+
+bool HLuminateServer::GetFrameTiles(std::string sessionId, unsigned int baseFrameId, int quality, std::vector<unsigned char>& payload)
+{
+    const int tileSize = 64;
+
+    std::vector<unsigned char> rgba;
+    int width = 0, height = 0;
+    bool bConverged = false;
+    float denoiseStrength = 0.f;
+
+    if (!readFrame(sessionId, rgba, width, height, bConverged, denoiseStrength))
+        return false;
+
+    std::shared_ptr<StreamedFrame> streamed;
+    {
+        std::lock_guard<std::mutex> lock(m_streamMutex);
+        std::shared_ptr<StreamedFrame>& entry = m_mStreamedFrame[sessionId];
+        if (!entry)
+            entry = std::make_shared<StreamedFrame>();
+        streamed = entry;
+    }
+
+    // Diff and encode outside of m_streamMutex, other sessions stream meanwhile
+    std::lock_guard<std::mutex> lock(streamed->mutex);
+
+    // Send the whole frame unless the client holds the last one streamed
+    bool bDelta = 0 != baseFrameId && baseFrameId == streamed->frameId &&
+        width == streamed->width && height == streamed->height;
+
+    unsigned int frameId = streamed->frameId + 1;
+    if (0 == frameId)
+        frameId = 1;
+
+    if (!encodeFrameTiles(&rgba[0], bDelta ? &streamed->rgba[0] : NULL, width, height, tileSize,
+        bConverged, quality, frameId, streamed->tileLossless, payload))
+        return false;
+
+    streamed->frameId = frameId;
+    streamed->width = width;
+    streamed->height = height;
+    streamed->rgba.swap(rgba);
+
+    return true;
+}
+
 bool HLuminateServer::ClearSession(std::string sessionId)
 {
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return ClearSession(sessionId); });
+
+    discardPrebuiltScene(sessionId);
+
     if (m_mHLuminateSession.count(sessionId))
     {
         RED_RC rc;
@@ -179,6 +665,19 @@ bool HLuminateServer::ClearSession(std::string sessionId)
         LuminateSession lumSession = m_mHLuminateSession[sessionId];
         lumSession.pHCLuminateBridge->resetFrame();
 
+        // Release the window and the scene only, other sessions keep running
+        lumSession.pHCLuminateBridge->shutdown();
+
+        delete lumSession.pHCLuminateBridge;
+
+        // Library clones are not part of the converted scene
+        if (m_mMaterialAssignments.count(sessionId))
+        {
+            for (auto const& materialEntry : m_mMaterialAssignments[sessionId].materialUsers)
+                ireamgr->DeleteMaterial(materialEntry.first, ireamgr->GetState());
+            m_mMaterialAssignments.erase(sessionId);
+        }
+
         // Delete env map
         for (int i = 0; i < lumSession.envMapArr.size(); i++)
         {
@@ -188,15 +687,22 @@ bool HLuminateServer::ClearSession(std::string sessionId)
             }
         }
 
-        lumSession.pHCLuminateBridge->shutdown();
-
-        delete lumSession.pHCLuminateBridge;
-
         if (NULL != lumSession.hwnd)
             DestroyWindow(lumSession.hwnd);
 
         m_mHLuminateSession.erase(sessionId);
 
+        {
+            std::lock_guard<std::mutex> lock(m_streamMutex);
+            m_mStreamedFrame.erase(sessionId);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_progressMutex);
+            m_mFrameProgress.erase(sessionId);
+        }
+        m_progressCondition.notify_all();
+
         return true;
     }
     return false;
@@ -204,9 +710,15 @@ bool HLuminateServer::ClearSession(std::string sessionId)
 
 bool HLuminateServer::LoadEnvMapFile(std::string sessionId, const char* filePath, const char* thumbnailPath)
 {
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return LoadEnvMapFile(sessionId, filePath, thumbnailPath); });
+
     if (m_mHLuminateSession.count(sessionId))
     {
         LuminateSession lumSession = m_mHLuminateSession[sessionId];
+
+        // The environment image is decoded and its thumbnail traced: no window may be tracing
+        interruptFrames();
         lumSession.pHCLuminateBridge->resetFrame();
 
         EnvironmentMapLightingModel envMap;
@@ -223,6 +735,9 @@ bool HLuminateServer::LoadEnvMapFile(std::string sessionId, const char* filePath
 bool HLuminateServer::SyncCamera(std::string sessionId,
     double* target, double* up, double* position, int projection, double cameraW, double cameraH)
 {
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return SyncCamera(sessionId, target, up, position, projection, cameraW, cameraH); });
+
     if (m_mHLuminateSession.count(sessionId))
     {
         LuminateSession lumSession = m_mHLuminateSession[sessionId];
@@ -240,6 +755,9 @@ bool HLuminateServer::Resize(std::string sessionId,
     double* target, double* up, double* position, int projection, double cameraW, double cameraH,
     int width, int height)
 {
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return Resize(sessionId, target, up, position, projection, cameraW, cameraH, width, height); });
+
     if (m_mHLuminateSession.count(sessionId))
     {
         LuminateSession lumSession = m_mHLuminateSession[sessionId];
@@ -253,19 +771,64 @@ bool HLuminateServer::Resize(std::string sessionId,
     return false;
 }
 
-void HLuminateServer::stopFrameTracing(HoopsLuminateBridge* bridge)
+void HLuminateServer::interruptFrames()
 {
-    RED::Object* resmgr = RED::Factory::CreateInstance(CID_REDResourceManager);
-    RED::IResourceManager* iresmgr = resmgr->As<RED::IResourceManager>();
+    // Image operations are immediate, every window traces under the shared transaction:
+    // all of them are stopped, commitFrameState begins their frames again afterwards
+    for (auto it = m_mHLuminateSession.begin(); it != m_mHLuminateSession.end(); ++it)
+    {
+        if (it->second.pHCLuminateBridge->interruptFrame())
+            it->second.bInterrupted = true;
+    }
+}
 
-    if (iresmgr->GetState().GetNumber() > 1) {
-        RED::IWindow* iwindow = bridge->getWindow()->As<RED::IWindow>();
-        iwindow->FrameTracingStop();
+void HLuminateServer::PreloadLibMaterials(std::string libraryDir)
+{
+    // Queued ahead of the first requests, the materials of the catalog are then only cloned
+    postToLuminateThread([this, libraryDir]() {
+        std::string catalogPath = libraryDir + "Catalog/material_list.json";
+        char* catalog = load_file(catalogPath.c_str());
+        if (NULL == catalog)
+            return;
+
+        if (RED_OK != initializeLuminate(HOOPS_LICENSE))
+        {
+            free(catalog);
+            return;
+        }
 
-        iresmgr->BeginState();
-    }
+        // The catalog is the one listed by the web client:
+        //   { "<category>": [ { "id": 0, "name": "...", "img": "....png", "redFile": "....red" }, ... ], ... }
+        // Only the "redFile" members are read, as "redFile": "<file name relative to libraryDir>".
+        // The file names hold no escaped character, other members are skipped.
+        const char* key = "\"redFile\"";
+        int loadedCnt = 0;
+        for (const char* pos = strstr(catalog, key); NULL != pos; pos = strstr(pos, key))
+        {
+            pos += strlen(key);
+            while (' ' == *pos || '\t' == *pos || '\r' == *pos || '\n' == *pos)
+                pos++;
+            if (':' != *pos)
+                continue;
+
+            const char* begin = pos + 1;
+            while (' ' == *begin || '\t' == *begin || '\r' == *begin || '\n' == *begin)
+                begin++;
+            const char* end = '"' == *begin ? strchr(begin + 1, '"') : NULL;
+            if (NULL == end)
+                continue;
+
+            std::string redfilename = libraryDir + std::string(begin + 1, end);
+            pos = end + 1;
+
+            RED::Object* libraryMaterial = nullptr;
+            if (loadLibMaterial(NULL, RED::String(redfilename.c_str()), libraryMaterial))
+                loadedCnt++;
+        }
+        free(catalog);
 
-    bridge->resetFrame();
+        printf("Library materials preloaded: %d\n", loadedCnt);
+    });
 }
 
 bool HLuminateServer::loadLibMaterial(HoopsLuminateBridge* bridge, RED::String redfilename, RED::Object*& libraryMaterial)
@@ -273,10 +836,25 @@ bool HLuminateServer::loadLibMaterial(HoopsLuminateBridge* bridge, RED::String r
     RED::Object* resmgr = RED::Factory::CreateInstance(CID_REDResourceManager);
     RED::IResourceManager* iresmgr = resmgr->As<RED::IResourceManager>();
 
+    // Already loaded and unchanged since
+    std::string filePath(redfilename.Buffer());
+    long long mtime = 0;
+    if (!get_file_mtime(filePath.c_str(), mtime))
+        return false;
+
+    std::map<std::string, LibraryMaterial>::iterator it = m_mLibraryMaterial.find(filePath);
+    if (it != m_mLibraryMaterial.end() && it->second.mtime == mtime)
+    {
+        libraryMaterial = it->second.material;
+        return true;
+    }
+
     // As a new material will be created, some images will be created as well.
     // Or images operations are immediate and should occur without ongoing rendering.
-    // Thus we need to stop current frame tracing.
-    stopFrameTracing(bridge);
+    // Thus we need to stop frame tracing, in every window.
+    interruptFrames();
+    if (NULL != bridge)
+        bridge->resetFrame();
 
     // create the file instance
     RED::Object* file = RED::Factory::CreateInstance(CID_REDFile);
@@ -297,96 +875,315 @@ bool HLuminateServer::loadLibMaterial(HoopsLuminateBridge* bridge, RED::String r
     RED::IDataManager* idatamgr = iresmgr->GetDataManager()->As<RED::IDataManager>();
 
     // parse the loaded contexts looking for the first material.
+    RED::Object* loadedMaterial = nullptr;
     for (unsigned int c = 0; c < contexts.size(); ++c) {
         unsigned int mcount;
         RC_CHECK(idatamgr->GetMaterialsCount(mcount, contexts[c]));
 
         if (mcount > 0) {
-            RC_CHECK(idatamgr->GetMaterial(libraryMaterial, contexts[c], 0));
+            RC_CHECK(idatamgr->GetMaterial(loadedMaterial, contexts[c], 0));
             break;
         }
     }
 
+    // Not cached, a fixed file is loaded again by the next request
+    if (nullptr == loadedMaterial)
+        return false;
+
+    // Materials cloned from the previous version of the file keep their own copy
+    if (it != m_mLibraryMaterial.end() && nullptr != it->second.material)
+        iresmgr->DeleteMaterial(it->second.material, iresmgr->GetState());
+
+    LibraryMaterial entry;
+    entry.mtime = mtime;
+    entry.material = loadedMaterial;
+    m_mLibraryMaterial[filePath] = entry;
+
+    libraryMaterial = loadedMaterial;
+    return true;
+}
+
+static RED_RC setControllerColor(RED::IMaterialController* iMaterialController, const RED::String& propertyName, const RED::Color& color)
+{
+    RED::Object* resmgr = RED::Factory::CreateInstance(CID_REDResourceManager);
+    RED::IResourceManager* iresmgr = resmgr->As<RED::IResourceManager>();
+
+    // Controllers of other material types may not expose the property
+    RED::Object* property = iMaterialController->GetProperty(propertyName);
+    if (property == nullptr)
+        return RED_OK;
+
+    return property->As<RED::IMaterialControllerProperty>()->SetColor(color, iresmgr->GetState());
+}
+
+static RED_RC setControllerFloat(RED::IMaterialController* iMaterialController, const RED::String& propertyName, float value)
+{
+    RED::Object* resmgr = RED::Factory::CreateInstance(CID_REDResourceManager);
+    RED::IResourceManager* iresmgr = resmgr->As<RED::IResourceManager>();
+
+    RED::Object* property = iMaterialController->GetProperty(propertyName);
+    if (property == nullptr)
+        return RED_OK;
+
+    return property->As<RED::IMaterialControllerProperty>()->SetFloat(value, iresmgr->GetState());
+}
+
+bool HLuminateServer::bindLibMaterialController(RED::Object* libraryMaterial, RED::Object* material, const RED::Color* diffuseColor)
+{
+    RED::Object* resmgr = RED::Factory::CreateInstance(CID_REDResourceManager);
+    RED::IResourceManager* iresmgr = resmgr->As<RED::IResourceManager>();
+
+    RED::Object* materialController = iresmgr->GetMaterialController(libraryMaterial);
+    if (nullptr == materialController)
+        return false;
+
+    // Reuse the controller of a material edited before, otherwise duplicate the library one
+    RED::Object* boundMaterialController = iresmgr->GetMaterialController(material);
+    if (nullptr == boundMaterialController)
+    {
+        RED_RC returnCode;
+        boundMaterialController = RED::Factory::CreateMaterialController(*resmgr,
+            material,
+            "Realistic",
+            "",
+            "Tunable realistic material",
+            "Realistic",
+            "Redway3d",
+            returnCode);
+
+        RC_CHECK(returnCode);
+    }
+
+    RED::IMaterialController* iBoundMaterialController =
+        boundMaterialController->As<RED::IMaterialController>();
+    RC_CHECK(iBoundMaterialController->CopyFrom(*materialController, material));
+
+    if (NULL != diffuseColor)
+    {
+        // Set node diffuse color as Luminate diffuse + reflection.
+
+        RED::Object* diffuseColorProperty = iBoundMaterialController->GetProperty(RED_MATCTRL_DIFFUSE_COLOR);
+        RED::IMaterialControllerProperty* iDiffuseColorProperty =
+            diffuseColorProperty->As<RED::IMaterialControllerProperty>();
+        iDiffuseColorProperty->SetColor(*diffuseColor, iresmgr->GetState());
+    }
+
     return true;
 }
 
 bool HLuminateServer::SetMaterial(std::string sessionId, const char* nodeName, RED::String redfilename, bool overrideMaterial, bool preserveColor)
 {
+    return SetMaterials(sessionId, std::vector<std::string>(1, std::string(nodeName)), redfilename, overrideMaterial, preserveColor);
+}
+
+bool HLuminateServer::SetMaterials(std::string sessionId, const std::vector<std::string>& nodeNames, RED::String redfilename, bool overrideMaterial, bool preserveColor)
+{
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return SetMaterials(sessionId, nodeNames, redfilename, overrideMaterial, preserveColor); });
+
     if (m_mHLuminateSession.count(sessionId))
     {
         LuminateSession lumSession = m_mHLuminateSession[sessionId];
 
         // Apply material
         HoopsLuminateBridgeEx* bridge = lumSession.pHCLuminateBridge;
-        RED::Object* selectedTransformNode = bridge->getSelectedLuminateTransformNode((char*)nodeName);
 
-        if (selectedTransformNode != nullptr) {
-            RED::Object* resmgr = RED::Factory::CreateInstance(CID_REDResourceManager);
-            RED::IResourceManager* iresmgr = resmgr->As<RED::IResourceManager>();
-            RED::IShape* iShape = selectedTransformNode->As<RED::IShape>();
+        RED::Object* resmgr = RED::Factory::CreateInstance(CID_REDResourceManager);
+        RED::IResourceManager* iresmgr = resmgr->As<RED::IResourceManager>();
 
-            RED::Object* libraryMaterial = nullptr;
-            loadLibMaterial(bridge, redfilename, libraryMaterial);
+        // Tracing is stopped once, when the library file has to be loaded, every assignment of the batch goes to the same state
+        RED::Object* libraryMaterial = nullptr;
+        if (!loadLibMaterial(bridge, redfilename, libraryMaterial))
+            return false;
 
-            if (libraryMaterial != nullptr) {
-                // Clone the material to be able to change its properties without altering the library one.
-                RED::Object* clonedMaterial;
-                RC_CHECK(iresmgr->CloneMaterial(clonedMaterial, libraryMaterial, iresmgr->GetState()));
+        MaterialAssignments& assignments = m_mMaterialAssignments[sessionId];
 
-                if (preserveColor)
-                {
-                    // Duplicate the material controller
-                    RED_RC returnCode;
-                    RED::Object* materialController = iresmgr->GetMaterialController(libraryMaterial);
-                    RED::Object* clonedMaterialController = RED::Factory::CreateMaterialController(*resmgr,
-                        clonedMaterial,
-                        "Realistic",
-                        "",
-                        "Tunable realistic material",
-                        "Realistic",
-                        "Redway3d",
-                        returnCode);
-
-                    RC_CHECK(returnCode);
-                    RED::IMaterialController* clonedIMaterialController =
-                        clonedMaterialController->As<RED::IMaterialController>();
-                    RC_CHECK(clonedIMaterialController->CopyFrom(*materialController, clonedMaterial));
-
-                    // Set node diffuse color as Luminate diffuse + reflection.
-
-                    RED::Object* diffuseColorProperty = clonedIMaterialController->GetProperty(RED_MATCTRL_DIFFUSE_COLOR);
-                    RED::IMaterialControllerProperty* iDiffuseColorProperty =
-                        diffuseColorProperty->As<RED::IMaterialControllerProperty>();
-                    iDiffuseColorProperty->SetColor(bridge->getSelectedLuminateDeffuseColor((char*)nodeName),
-                        iresmgr->GetState());
+        // Nodes getting the same result share a clone: a single one unless the node colors are preserved
+        std::map<std::vector<float>, RED::Object*> clonedMaterials;
+        std::set<RED::Object*> updatedMaterials;
 
-                }
+        for (const std::string& nodeName : nodeNames)
+        {
+            RED::Object* selectedTransformNode = bridge->getSelectedLuminateTransformNode((char*)nodeName.c_str());
+            if (selectedTransformNode == nullptr)
+                continue;
 
-                RED::Object* currentMaterial;
-                iShape->GetMaterial(currentMaterial);
+            RED::IShape* iShape = selectedTransformNode->As<RED::IShape>();
+
+            RED::Color diffuseColor = bridge->getSelectedLuminateDeffuseColor((char*)nodeName.c_str());
+
+            if (overrideMaterial)
+            {
+                std::vector<float> cloneKey;
+                if (preserveColor)
+                    cloneKey = { diffuseColor.R(), diffuseColor.G(), diffuseColor.B(), diffuseColor.A() };
 
-                if (overrideMaterial)
+                RED::Object* clonedMaterial = nullptr;
+                if (clonedMaterials.count(cloneKey))
                 {
-                    iShape->SetMaterial(clonedMaterial, iresmgr->GetState());
+                    clonedMaterial = clonedMaterials[cloneKey];
                 }
                 else
                 {
-                    RED::IMaterial* currentIMaterial = currentMaterial->As<RED::IMaterial>();
-                    RC_CHECK(currentIMaterial->CopyFrom(*clonedMaterial, iresmgr->GetState()));
+                    // Clone the material to be able to change its properties without altering the library one.
+                    // The clone gets its own controller, later edits go through it
+                    RC_CHECK(iresmgr->CloneMaterial(clonedMaterial, libraryMaterial, iresmgr->GetState()));
+                    bindLibMaterialController(libraryMaterial, clonedMaterial, preserveColor ? &diffuseColor : NULL);
+                    clonedMaterials[cloneKey] = clonedMaterial;
                 }
 
-                bridge->resetFrame();
+                RC_CHECK(iShape->SetMaterial(clonedMaterial, iresmgr->GetState()));
+                assignClonedMaterial(assignments, nodeName, clonedMaterial);
+            }
+            else
+            {
+                // Converted nodes may share their material, it is only overwritten once
+                RED::Object* currentMaterial;
+                iShape->GetMaterial(currentMaterial);
+
+                if (currentMaterial == nullptr || updatedMaterials.count(currentMaterial))
+                    continue;
+
+                // Copied straight from the library, no intermediate clone is left behind
+                RED::IMaterial* currentIMaterial = currentMaterial->As<RED::IMaterial>();
+                RC_CHECK(currentIMaterial->CopyFrom(*libraryMaterial, iresmgr->GetState()));
+                bindLibMaterialController(libraryMaterial, currentMaterial, preserveColor ? &diffuseColor : NULL);
+                updatedMaterials.insert(currentMaterial);
             }
         }
 
-        //lumSession.pHCLuminateBridge->applyMaterial(nodeName, redfilename, overrideMaterial, preserveColor);
+        bridge->resetFrame();
 
         return true;
     }
     return false;
 }
+
+void HLuminateServer::assignClonedMaterial(MaterialAssignments& assignments, const std::string& nodeName, RED::Object* clonedMaterial)
+{
+    RED::Object* resmgr = RED::Factory::CreateInstance(CID_REDResourceManager);
+    RED::IResourceManager* iresmgr = resmgr->As<RED::IResourceManager>();
+
+    assignments.materialUsers[clonedMaterial]++;
+
+    std::map<std::string, RED::Object*>::iterator it = assignments.nodeMaterial.find(nodeName);
+    if (it != assignments.nodeMaterial.end())
+    {
+        // The clone previously assigned to the node is deleted with its last user
+        RED::Object* previousMaterial = it->second;
+        if (0 == --assignments.materialUsers[previousMaterial])
+        {
+            assignments.materialUsers.erase(previousMaterial);
+            iresmgr->DeleteMaterial(previousMaterial, iresmgr->GetState());
+        }
+    }
+
+    assignments.nodeMaterial[nodeName] = clonedMaterial;
+}
+
+bool HLuminateServer::EditMaterial(std::string sessionId, const std::vector<std::string>& nodeNames, const MaterialEdit& edit)
+{
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return EditMaterial(sessionId, nodeNames, edit); });
+
+    if (m_mHLuminateSession.count(sessionId))
+    {
+        LuminateSession lumSession = m_mHLuminateSession[sessionId];
+        HoopsLuminateBridgeEx* bridge = lumSession.pHCLuminateBridge;
+
+        RED::Object* resmgr = RED::Factory::CreateInstance(CID_REDResourceManager);
+        RED::IResourceManager* iresmgr = resmgr->As<RED::IResourceManager>();
+
+        // Property changes update the shaders of the material, no image is created:
+        // the frame is only restarted once the edits are done
+        MaterialAssignments& assignments = m_mMaterialAssignments[sessionId];
+
+        // Nodes of the request grouped by their material, nodes sharing a material are edited together
+        std::map<RED::Object*, std::vector<std::pair<std::string, RED::IShape*>>> materialNodes;
+        for (const std::string& nodeName : nodeNames)
+        {
+            RED::Object* selectedTransformNode = bridge->getSelectedLuminateTransformNode((char*)nodeName.c_str());
+            if (selectedTransformNode == nullptr)
+                continue;
+
+            RED::IShape* iShape = selectedTransformNode->As<RED::IShape>();
+
+            RED::Object* currentMaterial;
+            iShape->GetMaterial(currentMaterial);
+            if (currentMaterial == nullptr)
+                continue;
+
+            // Only materials assigned from the library have a controller
+            if (iresmgr->GetMaterialController(currentMaterial) == nullptr)
+                continue;
+
+            materialNodes[currentMaterial].push_back(std::make_pair(nodeName, iShape));
+        }
+
+        std::set<RED::Object*> editedMaterials;
+        for (auto& entry : materialNodes)
+        {
+            RED::Object* material = entry.first;
+
+            // A material also used by nodes left out of the request is cloned for the listed ones.
+            // Converted materials may be shared by any node of the model, library clones count their users
+            std::map<RED::Object*, int>::iterator users = assignments.materialUsers.find(material);
+            if (users == assignments.materialUsers.end() || users->second > (int)entry.second.size())
+            {
+                RED::Object* clonedMaterial = nullptr;
+                RC_CHECK(iresmgr->CloneMaterial(clonedMaterial, material, iresmgr->GetState()));
+                bindLibMaterialController(material, clonedMaterial, NULL);
+
+                for (auto& node : entry.second)
+                {
+                    RC_CHECK(node.second->SetMaterial(clonedMaterial, iresmgr->GetState()));
+                    assignClonedMaterial(assignments, node.first, clonedMaterial);
+                }
+                material = clonedMaterial;
+            }
+
+            RED::Object* materialController = iresmgr->GetMaterialController(material);
+            if (materialController == nullptr)
+                continue;
+
+            RED::IMaterialController* iMaterialController = materialController->As<RED::IMaterialController>();
+
+            if (edit.bDiffuseColor)
+                RC_CHECK(setControllerColor(iMaterialController, RED_MATCTRL_DIFFUSE_COLOR, edit.diffuseColor));
+
+            if (edit.bReflectionColor)
+                RC_CHECK(setControllerColor(iMaterialController, RED_MATCTRL_REFLECTION_COLOR, edit.reflectionColor));
+
+            // Luminate expresses roughness as reflection glossiness
+            if (0.f <= edit.roughness)
+                RC_CHECK(setControllerFloat(iMaterialController, RED_MATCTRL_REFLECTION_GLOSSINESS, 1.f - edit.roughness));
+
+            if (0.f < edit.ior)
+                RC_CHECK(setControllerFloat(iMaterialController, RED_MATCTRL_IOR, edit.ior));
+
+            // Transmission is the grey level of the refraction color
+            if (0.f <= edit.transmission)
+                RC_CHECK(setControllerColor(iMaterialController, RED_MATCTRL_REFRACTION_COLOR,
+                    RED::Color(edit.transmission, edit.transmission, edit.transmission, 1.f)));
+
+            editedMaterials.insert(material);
+        }
+
+        if (editedMaterials.empty())
+            return false;
+
+        bridge->resetFrame();
+
+        return true;
+    }
+    return false;
+}
+
 bool HLuminateServer::SetLighting(std::string sessionId, int lightingId)
 {
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return SetLighting(sessionId, lightingId); });
+
     if (m_mHLuminateSession.count(sessionId))
     {
         LuminateSession lumSession = m_mHLuminateSession[sessionId];
@@ -406,8 +1203,71 @@ bool HLuminateServer::SetLighting(std::string sessionId, int lightingId)
     return false;
 }
 
+bool HLuminateServer::SetRenderQuality(std::string sessionId, RenderQuality quality)
+{
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return SetRenderQuality(sessionId, quality); });
+
+    if (m_mHLuminateSession.count(sessionId))
+    {
+        LuminateSession lumSession = m_mHLuminateSession[sessionId];
+
+        if (RED_OK != lumSession.pHCLuminateBridge->setRenderQuality(quality))
+            return false;
+
+        return true;
+    }
+    return false;
+}
+
+bool HLuminateServer::SetDenoise(std::string sessionId, bool enable)
+{
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return SetDenoise(sessionId, enable); });
+
+    if (m_mHLuminateSession.count(sessionId))
+    {
+        m_mHLuminateSession[sessionId].bDenoise = enable;
+        return true;
+    }
+    return false;
+}
+
+bool HLuminateServer::SetConvergenceThreshold(std::string sessionId, float threshold, int minPasses)
+{
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return SetConvergenceThreshold(sessionId, threshold, minPasses); });
+
+    if (m_mHLuminateSession.count(sessionId))
+    {
+        m_mHLuminateSession[sessionId].pHCLuminateBridge->setConvergenceThreshold(threshold, minPasses);
+        return true;
+    }
+    return false;
+}
+
+bool HLuminateServer::SetRegionOfInterest(std::string sessionId, const ScreenRegion* region, int density)
+{
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return SetRegionOfInterest(sessionId, region, density); });
+
+    if (m_mHLuminateSession.count(sessionId))
+    {
+        HoopsLuminateBridgeEx* bridge = m_mHLuminateSession[sessionId].pHCLuminateBridge;
+
+        if (NULL == region)
+            return RED_OK == bridge->clearRegionOfInterest();
+
+        return RED_OK == bridge->setRegionOfInterest(*region, density);
+    }
+    return false;
+}
+
 bool HLuminateServer::SetModelTransform(std::string sessionId, double* matrix)
 {
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return SetModelTransform(sessionId, matrix); });
+
     if (m_mHLuminateSession.count(sessionId))
     {
         LuminateSession lumSession = m_mHLuminateSession[sessionId];
@@ -419,8 +1279,39 @@ bool HLuminateServer::SetModelTransform(std::string sessionId, double* matrix)
     return false;
 }
 
+bool HLuminateServer::SetNodeMatrices(std::string sessionId, const std::vector<std::string>& nodeIds, const double* matrices)
+{
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return SetNodeMatrices(sessionId, nodeIds, matrices); });
+
+    if (m_mHLuminateSession.count(sessionId))
+    {
+        LuminateSession lumSession = m_mHLuminateSession[sessionId];
+
+        return lumSession.pHCLuminateBridge->setNodeMatrices(nodeIds, matrices);
+    }
+    return false;
+}
+
+bool HLuminateServer::SetNodesVisibility(std::string sessionId, const std::vector<std::string>& nodeIds, const int* visibilities)
+{
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return SetNodesVisibility(sessionId, nodeIds, visibilities); });
+
+    if (m_mHLuminateSession.count(sessionId))
+    {
+        LuminateSession lumSession = m_mHLuminateSession[sessionId];
+
+        return lumSession.pHCLuminateBridge->setNodesVisibility(nodeIds, visibilities);
+    }
+    return false;
+}
+
 bool HLuminateServer::DownloadImage(std::string sessionId)
 {
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return DownloadImage(sessionId); });
+
     if (m_mHLuminateSession.count(sessionId))
     {
         LuminateSession lumSession = m_mHLuminateSession[sessionId];
@@ -429,13 +1320,16 @@ bool HLuminateServer::DownloadImage(std::string sessionId)
     return false;
 }
 
-bool HLuminateServer::AddFloorMesh(const std::string sessionId, const int pointCnt, const double* points, const int faceCnt, const int* faceList, const double* uvs)
+bool HLuminateServer::AddFloorMesh(const std::string sessionId, const int vertexCount, const float* points, const int triangleCount, const int* indices, const float* uvs)
 {
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return AddFloorMesh(sessionId, vertexCount, points, triangleCount, indices, uvs); });
+
     if (m_mHLuminateSession.count(sessionId))
     {
         LuminateSession lumSession = m_mHLuminateSession[sessionId];
 
-        if (lumSession.pHCLuminateBridge->addFloorMesh(pointCnt, points, faceCnt, faceList, uvs))
+        if (lumSession.pHCLuminateBridge->addFloorMesh(vertexCount, points, triangleCount, indices, uvs))
         {
             RED::Object* mesh = lumSession.pHCLuminateBridge->getFloorMesh();
             if (nullptr == mesh)
@@ -451,6 +1345,9 @@ bool HLuminateServer::AddFloorMesh(const std::string sessionId, const int pointC
 
 bool HLuminateServer::DeleteFloorMesh(const std::string sessionId)
 {
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return DeleteFloorMesh(sessionId); });
+
     if (m_mHLuminateSession.count(sessionId))
     {
         LuminateSession lumSession = m_mHLuminateSession[sessionId];
@@ -462,21 +1359,30 @@ bool HLuminateServer::DeleteFloorMesh(const std::string sessionId)
     return false;
 }
 
-bool HLuminateServer::UpdateFloorMaterial(const std::string sessionId, const double* color, const char* texturePath, const double uvScale)
+bool HLuminateServer::UpdateFloorMaterial(const std::string sessionId, const double* color, const char* texturePath, const unsigned long long textureHash, const double uvScale)
 {
+    if (!isLuminateThread())
+        return runOnLuminateThread<bool>([&]() { return UpdateFloorMaterial(sessionId, color, texturePath, textureHash, uvScale); });
+
     if (m_mHLuminateSession.count(sessionId))
     {
         LuminateSession lumSession = m_mHLuminateSession[sessionId];
 
-        lumSession.pHCLuminateBridge->updateFloorMaterial(color, texturePath, uvScale);
+        // Decoding a new texture is an immediate image operation, it must not overlap tracing.
+        // Other changes only restart the frame
+        if (lumSession.pHCLuminateBridge->isFloorImageUpdateRequired(texturePath, textureHash))
+            interruptFrames();
 
-        return true;
+        return lumSession.pHCLuminateBridge->updateFloorMaterial(color, texturePath, textureHash, uvScale);
     }
     return false;
 }
 
 int HLuminateServer::GetNewEnvMapId(const std::string sessionId)
 {
+    if (!isLuminateThread())
+        return runOnLuminateThread<int>([&]() { return GetNewEnvMapId(sessionId); });
+
     if (m_mHLuminateSession.count(sessionId))
     {
         LuminateSession lumSession = m_mHLuminateSession[sessionId];
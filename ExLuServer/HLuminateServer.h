@@ -1,16 +1,37 @@
 #pragma once
 #include <string>
 #include <map>
+#include <set>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <atomic>
 #include "hoops_luminate_bridge/include/hoops_luminate_bridge/HoopsExLuminateBridge.h"
 #include "ExProcess.h"
+#include "FrameEncoder.h"
 
 using namespace hoops_luminate_bridge;
 
+// Controller properties changed by EditMaterial, negative values are left unchanged
+struct MaterialEdit
+{
+	bool bDiffuseColor = false;
+	RED::Color diffuseColor;
+	bool bReflectionColor = false;
+	RED::Color reflectionColor;
+	float roughness = -1.f;
+	float ior = -1.f;
+	float transmission = -1.f;
+};
+
 class HLuminateServer
 {
 public:
-	HLuminateServer() {}
-	~HLuminateServer(){}
+	HLuminateServer();
+	~HLuminateServer();
 
 private:
 	struct LuminateSession
@@ -18,22 +39,114 @@ private:
 		HoopsLuminateBridgeEx* pHCLuminateBridge = NULL;
 		HWND hwnd;
 		std::vector<EnvironmentMapLightingModel> envMapArr;
+		bool bRendering = false; // Refined by the Luminate thread until the frame converges
+		bool bDenoise = false;   // Early passes are denoised before they are encoded
+		bool bInterrupted = false; // Stopped for an image operation, begins again with the next commit
+		bool bBudgetRender = false; // A Render call owns the frame budget until it returns
 	};
 
 	std::map<std::string, LuminateSession> m_mHLuminateSession;
 
-	void stopFrameTracing(HoopsLuminateBridge* bridge);
+	// Luminate scenes built right after upload, before the session starts rendering
+	struct PrebuiltScene
+	{
+		ExSceneDataPtr sceneData;
+		LuminateSceneInfoPtr sceneInfo;
+	};
+	std::map<std::string, PrebuiltScene> m_mPrebuiltScene;
+
+	// Materials loaded from .red files, shared by every session and cloned on assignment.
+	// Keyed by file path, reloaded when the file is modified
+	struct LibraryMaterial
+	{
+		long long mtime = 0;
+		RED::Object* material = nullptr;
+	};
+	std::map<std::string, LibraryMaterial> m_mLibraryMaterial;
+
+	// Library clones assigned to the nodes of a session, deleted once no node uses them
+	struct MaterialAssignments
+	{
+		std::map<std::string, RED::Object*> nodeMaterial;
+		std::map<RED::Object*, int> materialUsers;
+	};
+	std::map<std::string, MaterialAssignments> m_mMaterialAssignments;
+
+	// Luminate calls of every session are serialized on this thread,
+	// m_mHLuminateSession is only touched from it
+	std::thread m_luminateThread;
+	std::mutex m_taskMutex;
+	std::condition_variable m_taskCondition;
+	std::deque<std::function<void()>> m_tasks;
+	bool m_bStopThread;
+
+	// Sum of the session weights, refreshed by the Luminate thread for the process server
+	std::atomic<int> m_renderDemand;
+
+	// Soft tracer threads handed out by the host, -1 until it gives a budget. Rendering pauses at 0
+	int m_threadBudget;
+
+	// Last frame streamed to a session, the next tiles are diffed against it
+	struct StreamedFrame
+	{
+		std::mutex mutex;
+		unsigned int frameId = 0;
+		int width = 0;
+		int height = 0;
+		std::vector<unsigned char> rgba;
+		std::vector<bool> tileLossless;
+	};
+	std::mutex m_streamMutex;
+	std::map<std::string, std::shared_ptr<StreamedFrame>> m_mStreamedFrame;
+
+	// Statistics published after each pass for the event streams of a session
+	struct FrameProgress
+	{
+		unsigned int passId = 0;
+		FrameStatistics statistics;
+	};
+	std::mutex m_progressMutex;
+	std::condition_variable m_progressCondition;
+	std::map<std::string, FrameProgress> m_mFrameProgress;
+	bool m_bStopProgress;
+
+	void luminateThreadLoop();
+	bool hasPendingFrames();
+	bool hasInteractiveSessions();
+	int getSessionWeight(const LuminateSession& lumSession);
+	void drawPendingFrames();
+	void commitFrameState(const std::string& drawnSessionId = "");
+	void stopLuminateThread();
+	void publishFrameProgress(const std::string& sessionId, const FrameStatistics& statistics);
+	bool isLuminateThread() const;
+	template <typename T> T runOnLuminateThread(std::function<T()> task);
+	void postToLuminateThread(std::function<void()> task);
+	void discardPrebuiltScene(const std::string& sessionId);
+	bool readFrame(std::string sessionId, std::vector<unsigned char>& rgba, int& width, int& height, bool& bConverged, float& denoiseStrength);
+
+	void interruptFrames();
 	bool loadLibMaterial(HoopsLuminateBridge* bridge, RED::String redfilename, RED::Object*& libraryMaterial);
+	bool bindLibMaterialController(RED::Object* libraryMaterial, RED::Object* material, const RED::Color* diffuseColor);
+	void assignClonedMaterial(MaterialAssignments& assignments, const std::string& nodeName, RED::Object* clonedMaterial);
 
 public:
 	bool Terminate();
+	void PreloadLibMaterials(std::string libraryDir);
+	void SetThreadBudget(int threadCount);
+	int GetRenderDemand();
 	bool PrepareRendering(std::string sessionId, 
 		double* target, double* up, double* position, int projection, double cameraW, double cameraH, 
 		int width, int height);
+	void PrebuildScene(std::string sessionId, ExSceneDataPtr sceneData);
 	bool StartRendering(std::string sessionId,
 		double* target, double* up, double* position, int projection, double cameraW, double cameraH,
-		int width, int height, A3DAsmModelFile* pModelFile, A3DEntity* pPrcIdMap);
-	std::vector<float> Draw(std::string sessionId, char* filePath);
+		int width, int height, ExSceneDataPtr sceneData);
+	std::vector<float> Draw(std::string sessionId);
+	bool WaitFrameProgress(std::string sessionId, unsigned int& passId, FrameStatistics& statistics, int timeoutMilliseconds);
+	bool GetFrame(std::string sessionId, FrameFormat& format, int quality, std::vector<unsigned char>& image);
+	bool GetFrameTiles(std::string sessionId, unsigned int baseFrameId, int quality, std::vector<unsigned char>& payload);
+	bool Render(std::string sessionId, int timeBudgetMilliseconds, int passBudget,
+		FrameFormat& format, int quality, std::vector<unsigned char>& image, FrameStatistics& statistics);
 	bool ClearSession(std::string sessionId);
 	bool LoadEnvMapFile(std::string sessionId, const char* filePath, const char* thumbnailPath);
 	bool SyncCamera(std::string sessionId,
@@ -42,12 +155,20 @@ public:
 		double* target, double* up, double* position, int projection, double cameraW, double cameraH,
 		int width, int height);
 	bool SetMaterial(std::string sessionId, const char* nodeName, RED::String redfilename, bool overrideMaterial, bool preserveColor);
+	bool SetMaterials(std::string sessionId, const std::vector<std::string>& nodeNames, RED::String redfilename, bool overrideMaterial, bool preserveColor);
+	bool EditMaterial(std::string sessionId, const std::vector<std::string>& nodeNames, const MaterialEdit& edit);
 	bool SetLighting(std::string sessionId, int lightingId);
+	bool SetRenderQuality(std::string sessionId, RenderQuality quality);
+	bool SetDenoise(std::string sessionId, bool enable);
+	bool SetConvergenceThreshold(std::string sessionId, float threshold, int minPasses);
+	bool SetRegionOfInterest(std::string sessionId, const ScreenRegion* region, int density);
 	bool SetModelTransform(std::string sessionId, double* matrix);
+	bool SetNodeMatrices(std::string sessionId, const std::vector<std::string>& nodeIds, const double* matrices);
+	bool SetNodesVisibility(std::string sessionId, const std::vector<std::string>& nodeIds, const int* visibilities);
 	bool DownloadImage(std::string sessionId);
-	bool AddFloorMesh(const std::string sessionId, const int pointCnt, const double* points, const int faceCnt, const int* faceList, const double* uvs);
+	bool AddFloorMesh(const std::string sessionId, const int vertexCount, const float* points, const int triangleCount, const int* indices, const float* uvs);
 	bool DeleteFloorMesh(const std::string sessionId);
-	bool UpdateFloorMaterial(const std::string sessionId, const double* color, const char* texturePath, const double uvScale = 0.0);
+	bool UpdateFloorMaterial(const std::string sessionId, const double* color, const char* texturePath, const unsigned long long textureHash, const double uvScale = 0.0);
 	int GetNewEnvMapId(const std::string sessionId);
 };
 
@@ -0,0 +1,122 @@
+#include "NumaPlacement.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#if defined(_WIN32)
+#include <Windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__)
+namespace
+{
+    // From <numaif.h>, set_mempolicy is called directly to avoid a libnuma dependency
+    const int kMpolPreferred = 1;
+
+    // Parse a sysfs cpu list such as "0-15,32-47"
+    bool readCpuList(const int node, std::vector<int>& cpus)
+    {
+        char path[256];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+        FILE* fp = fopen(path, "r");
+        if (NULL == fp)
+            return false;
+
+        char buffer[4096];
+        bool bRead = NULL != fgets(buffer, sizeof(buffer), fp);
+        fclose(fp);
+        if (!bRead)
+            return false;
+
+        char* token = strtok(buffer, ",\n");
+        while (NULL != token)
+        {
+            int first = 0, last = 0;
+            int count = sscanf(token, "%d-%d", &first, &last);
+            if (1 == count)
+                last = first;
+            if (0 < count)
+            {
+                for (int cpu = first; cpu <= last; cpu++)
+                    cpus.push_back(cpu);
+            }
+            token = strtok(NULL, ",\n");
+        }
+
+        return !cpus.empty();
+    }
+}
+#endif
+
+int getNumaNodeCount()
+{
+#if defined(_WIN32)
+    ULONG highestNode = 0;
+    if (!GetNumaHighestNodeNumber(&highestNode))
+        return 1;
+    return (int)highestNode + 1;
+#elif defined(__linux__)
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (NULL == dir)
+        return 1;
+
+    int nodeCount = 0;
+    struct dirent* entry;
+    while (NULL != (entry = readdir(dir)))
+    {
+        int node;
+        if (1 == sscanf(entry->d_name, "node%d", &node))
+            nodeCount++;
+    }
+    closedir(dir);
+
+    return 0 < nodeCount ? nodeCount : 1;
+#else
+    return 1;
+#endif
+}
+
+bool bindToNumaNode(const int node)
+{
+    if (node < 0 || getNumaNodeCount() <= node)
+        return false;
+
+#if defined(_WIN32)
+    // Memory is allocated on the node of the processor by default, the affinity is enough
+    ULONGLONG nodeMask = 0;
+    if (!GetNumaNodeProcessorMask((UCHAR)node, &nodeMask) || 0 == nodeMask)
+        return false;
+
+    return FALSE != SetProcessAffinityMask(GetCurrentProcess(), (DWORD_PTR)nodeMask);
+#elif defined(__linux__)
+    std::vector<int> cpus;
+    if (!readCpuList(node, cpus))
+        return false;
+
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (size_t i = 0; i < cpus.size(); i++)
+    {
+        if (cpus[i] < CPU_SETSIZE)
+            CPU_SET(cpus[i], &cpuSet);
+    }
+
+    if (0 != sched_setaffinity(0, sizeof(cpuSet), &cpuSet))
+        return false;
+
+    // Preferred rather than bound: allocations still succeed once the node is full
+    std::vector<unsigned long> nodeMask(node / (8 * sizeof(unsigned long)) + 1, 0);
+    nodeMask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+
+    return 0 == syscall(SYS_set_mempolicy, kMpolPreferred, &nodeMask[0], nodeMask.size() * 8 * sizeof(unsigned long) + 1);
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+/**
+ * Get the number of NUMA nodes of the host.
+ * @return Node count, 1 when the host or the platform has no NUMA information.
+ */
+int getNumaNodeCount();
+
+/**
+ * Bind the calling thread to the processors of a NUMA node and prefer the memory
+ * of that node for its allocations.
+ * Threads created afterwards inherit the binding, so this must be called before
+ * any worker thread is started (Luminate tracer, Exchange, HTTP daemon).
+ * @param[in] node NUMA node index.
+ * @return True if success, otherwise False.
+ */
+bool bindToNumaNode(const int node);
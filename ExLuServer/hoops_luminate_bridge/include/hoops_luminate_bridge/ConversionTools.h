@@ -3,6 +3,7 @@
 
 #include <string>
 #include <map>
+#include <set>
 #include <memory>
 #include <vector>
 #include <REDObject.h>
@@ -209,6 +210,7 @@ namespace hoops_luminate_bridge {
      * - Map associated 3DF/HPS PBR to Luminate realistic material conversion input with its conversion output.
      * - Map associating a material description and its Luminate material instance.
      * - Default material description from which all materials will be built, overriding some attributes.
+     * - Shapes detached from the scene graph, e.g. hidden nodes, deleted along with the scene.
      */
     struct LuminateSceneInfo {
         Handedness viewHandedness = Handedness::LeftHanded;
@@ -220,6 +222,7 @@ namespace hoops_luminate_bridge {
         PBRToRealisticConversionMap pbrToRealisticConversionMap;
         RealisticMaterialMap materials;
         RealisticMaterialInfo defaultMaterialInfo;
+        std::set<RED::Object*> detachedShapes;
     };
 
     using LuminateSceneInfoPtr = std::shared_ptr<LuminateSceneInfo>;
@@ -7,7 +7,8 @@
 
 namespace hoops_luminate_bridge {
 	/**
-	 * Mapping between segment hash and associated Luminate mesh shapes.
+	 * Mapping between a mesh of the extracted scene, keyed by its index in ExSceneData::meshes,
+	 * and its Luminate mesh shapes. Occurrences of the same representation item share them.
 	 */
 	using SegmentMeshShapesMap = std::map<intptr_t, std::vector<RED::Object*>>;
 
@@ -27,6 +28,40 @@ namespace hoops_luminate_bridge {
 
 	using ConversionContextNodePtr = std::shared_ptr<ConversionContextNode>;
 
+	/**
+	 * Tessellation of an Exchange representation item, converted to
+	 * the float and index buffers expected by RED mesh shapes.
+	 */
+	struct ExMeshBuffers {
+		A3DEntity* riEntity = nullptr; // Only valid during extractExScene
+		A3DMiscCascadedAttributes* cascadedAttributes = nullptr;
+		std::vector<float> points;
+		std::vector<float> normals;
+		std::vector<int> indices;
+		int triangleCount = 0;
+	};
+
+	/**
+	 * Exchange tree node referencing a representation item, with its net transform and style.
+	 */
+	struct ExNodeInstance {
+		std::string prcId;
+		double matrix[16];
+		A3DGraphRgbColorData color;
+		int meshIndex;
+	};
+
+	/**
+	 * Luminate independent description of an Exchange model, produced by extractExScene
+	 * and turned into RED shapes by buildLuminateScene.
+	 */
+	struct ExSceneData {
+		std::vector<ExMeshBuffers> meshes;
+		std::vector<ExNodeInstance> nodes;
+	};
+
+	using ExSceneDataPtr = std::shared_ptr<ExSceneData>;
+
 	class HoopsLuminateBridgeEx : public HoopsLuminateBridge
 	{
 	public:
@@ -36,13 +71,27 @@ namespace hoops_luminate_bridge {
 	private:
 		A3DAsmModelFile* m_pModelFile;
 		A3DEntity* m_pPrcIdMap;
+		ExSceneDataPtr m_sceneData;
+		LuminateSceneInfoPtr m_prebuiltScene;
+		ExSceneDataPtr m_convertedSceneData; // Source of the current Luminate scene
+		bool m_isSceneConverted; // The current Luminate scene is a ConversionContextNode
 
 		// Floor UV param
 		std::vector<float> m_floorUVArr;
+		std::vector<float> m_floorScaledUVArr;
+		double m_floorUVScale; // Scale of the UVs set on the floor mesh, 0 if unscaled
+
+		// Floor material and texture, kept across updates and floor meshes
+		RED::Object* m_floorMaterial;
+		RED::Object* m_floorTexture;
+		unsigned long long m_floorTextureHash; // Content hash of the image loaded in m_floorTexture
+		std::vector<double> m_floorColor;
+		bool m_floorHasTexture;
 
 	public:
 		void saveCameraState() override;
 		LuminateSceneInfoPtr convertScene() override;
+		bool isConvertedSceneCurrent() const override;
 		bool checkCameraChange() override;
 		CameraInfo getCameraInfo() override;
 		void updateSelectedSegmentTransform() override;
@@ -53,13 +102,91 @@ namespace hoops_luminate_bridge {
 
 	public:
 		void setModelFile(A3DAsmModelFile* pModelFile, A3DEntity* pPrcIdMap) { m_pModelFile = pModelFile; m_pPrcIdMap = pPrcIdMap; }
-		bool addFloorMesh(const int pointCnt, const double* points, const int faceCnt, const int* faceList, const double* uvs);
+		void setSceneData(ExSceneDataPtr a_sceneData) { m_sceneData = a_sceneData; }
+		void setPrebuiltScene(LuminateSceneInfoPtr a_sceneInfo) { m_prebuiltScene = a_sceneInfo; }
+		/**
+		 * Add a floor mesh under the scene root.
+		 * @param[in] vertexCount Number of vertices.
+		 * @param[in] points Vertex positions, 3 floats per vertex.
+		 * @param[in] triangleCount Number of triangles.
+		 * @param[in] indices Vertex indices, 3 per triangle.
+		 * @param[in] uvs Texture coordinates, 2 floats per vertex, nullptr to build them.
+		 * @return True if success, otherwise False.
+		 */
+		bool addFloorMesh(const int vertexCount, const float* points, const int triangleCount, const int* indices, const float* uvs);
 		bool deleteFloorMesh();
-		bool updateFloorMaterial(const double* color, const char* texturePath, const double uvScale = 0.0);
+		/**
+		 * Update the floor material in place. The texture is only decoded when its content changes.
+		 * @param[in] color Diffuse color and opacity of the floor, RGBA.
+		 * @param[in] texturePath Image file of the floor texture, empty for none.
+		 * @param[in] textureHash Content hash of the image file.
+		 * @param[in] uvScale Scale of the floor UVs, 0 to keep them unscaled.
+		 * @return True if success, otherwise False.
+		 */
+		bool updateFloorMaterial(const double* color, const char* texturePath, const unsigned long long textureHash, const double uvScale = 0.0);
+
+		/**
+		 * Tell whether updateFloorMaterial would create or load images, which must not overlap tracing.
+		 * @param[in] texturePath Image file of the floor texture, empty for none.
+		 * @param[in] textureHash Content hash of the image file.
+		 * @return True if the floor material or its texture are to be (re)created, otherwise False.
+		 */
+		bool isFloorImageUpdateRequired(const char* texturePath, const unsigned long long textureHash) const;
 		RED::Object* getFloorMesh();
 
+		/**
+		 * Move scene nodes in place, without converting the scene again.
+		 * @param[in] a_nodeIds PRC IDs of the nodes, unknown IDs are skipped.
+		 * @param[in] a_matrices Column major net matrices of the nodes in model space, 16 values per node.
+		 * @return True if success, otherwise False.
+		 */
+		bool setNodeMatrices(std::vector<std::string> const& a_nodeIds, const double* a_matrices);
+
+		/**
+		 * Show or hide scene nodes, without converting the scene again.
+		 * Hidden nodes are detached from the model transform, their shapes are kept for when they are shown again.
+		 * @param[in] a_nodeIds PRC IDs of the nodes, unknown IDs are skipped.
+		 * @param[in] a_visibilities Visibility of each node, 0 to hide it.
+		 * @return True if success, otherwise False.
+		 */
+		bool setNodesVisibility(std::vector<std::string> const& a_nodeIds, const int* a_visibilities);
+
 	};
 
+	/**
+	 * Collect the representation items of a model file with their net transforms and styles,
+	 * then build their mesh buffers, Exchange calls stay on the calling thread.
+	 * Only Exchange is used, no RED object is created.
+	 * @param[in] pModelFile Model file to extract.
+	 * @param[in] pPrcIdMap PRC ID map of the model file.
+	 * @return Extracted scene data.
+	 */
+	ExSceneDataPtr extractExScene(A3DAsmModelFile* pModelFile, A3DEntity* pPrcIdMap);
+
+	/**
+	 * Create the RED shapes, materials and transforms of an extracted scene.
+	 * Must be called from the thread driving Luminate.
+	 * @param[in] a_sceneData Scene data produced by extractExScene.
+	 * @return Luminate scene description.
+	 */
+	LuminateSceneInfoPtr buildLuminateScene(ExSceneData const& a_sceneData);
+
+	/**
+	 * Write an extracted scene to a binary file, it can then be rebuilt without Exchange.
+	 * Exchange entities are not written.
+	 * @param[in] a_sceneData Scene data produced by extractExScene.
+	 * @param[in] a_filepath Output file path.
+	 * @return True if success, otherwise False.
+	 */
+	bool writeExScene(ExSceneData const& a_sceneData, std::string const& a_filepath);
+
+	/**
+	 * Read a scene written by writeExScene.
+	 * @param[in] a_filepath Input file path.
+	 * @return Scene data, nullptr if the file is missing or was written by another version.
+	 */
+	ExSceneDataPtr readExScene(std::string const& a_filepath);
+
 	LuminateSceneInfoPtr convertExSceneToLuminate(A3DAsmModelFile* pModelFile, A3DEntity* pPrcIdMap);
 	RealisticMaterialInfo getSegmentMaterialInfo(A3DGraphRgbColorData a_sColor,
 		RED::Object* a_resourceManager,
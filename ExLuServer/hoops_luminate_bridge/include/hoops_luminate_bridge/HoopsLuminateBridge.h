@@ -3,6 +3,8 @@
 
 #include <string>
 #include <memory>
+#include <vector>
+#include <chrono>
 
 #include <RED.h>
 #include <REDObject.h>
@@ -33,6 +35,37 @@ namespace hoops_luminate_bridge {
         RED::Vector3 target;
     };
 
+    /**
+     * Structure storing a screen-space region, relative to the window size,
+     * with the origin at the top-left corner.
+     */
+    struct ScreenRegion {
+        float left;
+        float top;
+        float right;
+        float bottom;
+    };
+
+    /**
+     * Enumeration of the named render quality profiles.
+     * Custom starts from the Interactive values.
+     */
+    enum class RenderProfile { Draft, Interactive, Final, Custom };
+
+    /**
+     * Structure storing the ray and path tracing settings of a window.
+     */
+    struct RenderQuality {
+        bool rayGI;
+        int giCachePassesCount;
+        int shadowsDepth;
+        int reflectionsDepth;
+        int refractionsDepth;
+        int transparencyDepth;
+        int pathGI;
+        int softAntiAlias;
+    };
+
     /**
      * Structure storing the frame statistics.
      */
@@ -42,6 +75,11 @@ namespace hoops_luminate_bridge {
         float remainingTimeMilliseconds;
         int numberOfPasses;
         int currentPass;
+        float elapsedMilliseconds;
+        int tracedPasses;
+        bool budgetIsReached;
+        float noiseLevel;
+        bool convergedEarly;
     };
 
     /**
@@ -87,6 +125,34 @@ namespace hoops_luminate_bridge {
         bool m_newFrameIsRequired;
         FrameStatistics m_lastFrameStatistics;
         RED::FRAME_TRACING_FEEDBACK m_frameTracingMode;
+        int m_softAntiAlias;
+
+        // Interactive mode: while camera updates keep arriving, frames are traced
+        // at a reduced resolution with low anti aliasing.
+        bool m_isInteractive;
+        int m_interactiveScale;
+        int m_interactiveDelayMilliseconds;
+        std::chrono::steady_clock::time_point m_lastCameraSync;
+
+        // Frame budget: the frame is done once either limit is reached, 0 for no limit.
+        int m_frameBudgetMilliseconds;
+        int m_frameBudgetPasses;
+        std::chrono::steady_clock::time_point m_frameStart;
+        int m_lastTracedPass;
+
+        // Early convergence: largest per tile change between two passes, 0 to trace every pass.
+        // m_previousPassPixels holds the RGB of the sampled tiles at the last measure.
+        float m_convergenceThreshold;
+        int m_convergenceMinPasses;
+        int m_quietPassCount;
+        std::vector<unsigned char> m_previousPassPixels;
+
+        // Region of interest: only this part of the view is traced, at m_regionDensity^2 samples
+        // per window pixel, and composited over the full frame traced before.
+        bool m_hasRegionOfInterest;
+        ScreenRegion m_regionOfInterest;
+        int m_regionDensity;
+        std::vector<unsigned char> m_regionBackground;
 
         // Axis triad.
         AxisTriad m_axisTriad;
@@ -124,12 +190,41 @@ namespace hoops_luminate_bridge {
          * Request to draw a new frame.
          * This method must be called continuously and will check by itself
          * if cameras must be sync and if a new render must be processed.
+         * A new frame is only traced once beginFrame() has been called.
          * @return True if success, otherwise False.
          */
         bool draw();
 
         /**
-         * Requests to start a fresh new frame.
+         * Apply the pending camera and quality changes before a new frame.
+         * @return True if a new frame is required, the RED transaction must
+         * then be committed and beginFrame() called.
+         */
+        bool prepareFrame();
+
+        /**
+         * Stop the frame being traced, if any, so that the RED transaction
+         * can be committed. The frame is started again from scratch.
+         * @return True if a frame was being traced, otherwise False.
+         */
+        bool interruptFrame();
+
+        /**
+         * Start the requested new frame, once the RED transaction holding its
+         * changes has been committed.
+         */
+        void beginFrame();
+
+        /**
+         * Tell whether draw() still has work to do: a camera sync or a new
+         * frame was requested, or the current frame is not fully traced yet.
+         * @return True if draw() must be called again, otherwise False.
+         */
+        bool isDrawRequired() const;
+
+        /**
+         * Requests to start a fresh new frame. Only this window is stopped,
+         * image operations need every window to be stopped first.
          */
         void resetFrame();
 
@@ -150,8 +245,9 @@ namespace hoops_luminate_bridge {
         bool saveAsRedFile(std::string const& a_outputFilepath);
 
         /**
-         * Shutdown completely Luminate.
-         * This will destroy and free everything.
+         * Shutdown the Luminate window of this bridge and its scene.
+         * The Luminate runtime and the shared lighting models are kept
+         * for the other windows, use shutdownLuminate to free everything.
          * @return True if success, otherwise False.
          */
         bool shutdown();
@@ -295,15 +391,102 @@ namespace hoops_luminate_bridge {
          */
         RED_RC removeLight(LuminateLight* a_luminateLight);
 
-        void setSyncCamera(const bool a_sync, CameraInfo a_cameraInfo) { m_bSyncCamera = a_sync; m_cameraInfo = a_cameraInfo; }
+        /**
+         * Request a camera sync on next draw.
+         * Camera updates arriving within the interactive delay switch to the interactive mode.
+         * @param[in] a_sync Whether to sync the camera.
+         * @param[in] a_cameraInfo Camera to sync with.
+         */
+        void setSyncCamera(const bool a_sync, CameraInfo a_cameraInfo);
+
+        /**
+         * Apply render quality settings to this window only and start a new frame.
+         * The scene is kept.
+         * @param[in] a_quality Settings to apply.
+         * @return RED_OK if success, otherwise error code.
+         */
+        RED_RC setRenderQuality(RenderQuality const& a_quality);
+
+        /**
+         * Limit the refinement of the next frames by time and/or number of passes.
+         * The frame stops at the first limit reached and is reported as done.
+         * A frame stopped by the previous budget resumes refining.
+         * @param[in] a_timeMilliseconds Wall-clock budget from the frame start, 0 for no limit.
+         * @param[in] a_passCount Number of traced passes, 0 for no limit.
+         */
+        void setFrameBudget(int a_timeMilliseconds, int a_passCount);
+
+        /**
+         * Stop refining a frame once it is visually converged.
+         * Every few passes one tile in four of the render image is compared with the previous measure,
+         * the frame is done once the largest tile change per pass stays below the threshold for two measures.
+         * @param[in] a_threshold RMS change of a tile per pass, in [0, 1] color units, 0 to trace every pass.
+         * @param[in] a_minPasses Passes always traced before the frame can stop.
+         */
+        void setConvergenceThreshold(float a_threshold, int a_minPasses);
+
+        /**
+         * Restrict tracing to a region of the view, the rest of the last frame is kept.
+         * The region is snapped to window pixels and dropped as soon as the camera moves or the window is resized.
+         * @param[in] a_region Region to trace, relative to the window size.
+         * @param[in] a_density Render pixels per window pixel along each axis, in [1, 4].
+         * @return RED_OK if success, otherwise error code.
+         */
+        RED_RC setRegionOfInterest(ScreenRegion const& a_region, int a_density);
+
+        /**
+         * Trace the whole view again.
+         * @return RED_OK if success, otherwise error code.
+         */
+        RED_RC clearRegionOfInterest();
+
+        /**
+         * Set the interactive mode parameters.
+         * @param[in] a_scale Render size divisor while the camera moves, 1 disables the interactive mode.
+         * @param[in] a_delayMilliseconds Camera idle time after which full resolution is restored.
+         */
+        void setInteractiveMode(int a_scale, int a_delayMilliseconds);
 
+        /**
+         * Tell whether frames are currently traced at interactive quality.
+         * @return True while the camera moves, otherwise False.
+         */
+        bool isInteractive() const;
+
+        /**
+         * Create an environment map lighting and trace its thumbnail.
+         * The RED transaction is committed: no other window may be tracing.
+         */
         RED_RC createEnvMapLightEnvironment(std::string const& a_imageFilepath, bool a_showImage, RED::Color const& a_backgroundColor, const char* thumbFilePath, EnvironmentMapLightingModel& envMap);
         
         CameraInfo creteCameraInfo(double* a_target, double* a_up, double* a_position, int a_projection, double a_width, double a_height);
 
         bool saveImg(const char* filePath);
 
+        /**
+         * Read back the current render image as 8 bit RGBA pixels.
+         * @param[out] a_rgba Pixels, rows stored top-down.
+         * @param[out] a_width Image width.
+         * @param[out] a_height Image height.
+         * @return RED_OK if success, otherwise error code.
+         */
+        RED_RC getRenderImagePixels(std::vector<unsigned char>& a_rgba, int& a_width, int& a_height);
+
       private:
+        /**
+         * Read back the render image of the aux VRL as is, region of interest included.
+         * @param[out] a_rgba Pixels, rows stored top-down.
+         * @param[out] a_width Image width.
+         * @param[out] a_height Image height.
+         * @return RED_OK if success, otherwise error code.
+         */
+        RED_RC readRenderImage(std::vector<unsigned char>& a_rgba, int& a_width, int& a_height);
+
+        /**
+         * Get the window pixels covered by the region of interest.
+         */
+        void getRegionRect(int& a_x, int& a_y, int& a_width, int& a_height) const;
+
         /**
          * Check if the Luminate camera must be synchronized with 3DF/HPS one.
          * @param[in] a_force Whether to force the camera synchro even if camera has not changed, or not.
@@ -317,6 +500,27 @@ namespace hoops_luminate_bridge {
          */
         RED_RC syncLuminateCamera(CameraInfo a_cameraInfo);
 
+        /**
+         * Switch the render image between interactive and full quality.
+         * The render image is resized and a new frame is started.
+         * @param[in] a_interactive True for the reduced resolution and anti aliasing.
+         * @return RED_OK if success, otherwise error code.
+         */
+        RED_RC setInteractiveQuality(bool a_interactive);
+
+        /**
+         * Tell whether the camera was idle for the interactive delay.
+         * @return True if full quality can be restored, otherwise False.
+         */
+        bool isCameraIdle() const;
+
+        /**
+         * Compare one 32x32 tile in four of the render image with the previous measure,
+         * taken a few passes before, which is then replaced.
+         * @return Largest RMS change per pass of a sampled tile, negative if there is no previous measure.
+         */
+        float measurePassNoise();
+
         /**
          * Synchronize the Luminate root transform with the 3DF/HPS one.
          * @return RED_OK if success, otherwise error code.
@@ -344,6 +548,13 @@ namespace hoops_luminate_bridge {
          */
         virtual LuminateSceneInfoPtr convertScene() = 0;
 
+        /**
+         * Tell whether the converted scene still matches the source model and conversion options,
+         * in which case syncScene keeps it along with its acceleration structure.
+         * @return True if the scene does not need to be converted again, otherwise False.
+         */
+        virtual bool isConvertedSceneCurrent() const { return false; }
+
         /**
          * Convert the 3DF/HPS camera to generic camera info.
          * @return Generic camera informations.
@@ -391,6 +602,30 @@ namespace hoops_luminate_bridge {
      */
     RED_RC setSoftTracerMode(int a_mode);
 
+    /**
+     * Get the settings of a named render profile.
+     * @param[in] a_profile Render profile.
+     * @return Render quality settings.
+     */
+    RenderQuality getRenderProfileQuality(RenderProfile a_profile);
+
+    /**
+     * Set the license, the soft tracer mode and the global rendering options.
+     * Only the first call does the work, so every window created afterwards
+     * shares the same Luminate runtime.
+     * @param[in] a_license Hoops unified license string.
+     * @return RED_OK if success, otherwise error code.
+     */
+    RED_RC initializeLuminate(std::string const& a_license);
+
+    /**
+     * Set the number of soft tracer threads shared by all windows.
+     * Applied right away once Luminate is initialized, otherwise by initializeLuminate.
+     * @param[in] a_threadCount Thread count, 0 for the default (processor count - 2).
+     * @return RED_OK if success, otherwise error code.
+     */
+    RED_RC setRayMaxThreadCount(int a_threadCount);
+
     /**
      * Create a new Luminate window.
      * @param[in] a_osHandle OS handler. The HWND on Windows or the X-Window id on Linux/UNIX.
@@ -419,6 +654,14 @@ namespace hoops_luminate_bridge {
      */
     RED_RC shutdownLuminate(RED::Object* a_window);
 
+    /**
+     * Stops window tracing and destroys the window, leaving
+     * the resource manager and the other windows alive.
+     * @param[in] a_window Window to destroy.
+     * @return RED_OK if success, otherwise error code.
+     */
+    RED_RC destroyRedWindow(RED::Object* a_window);
+
     /**
      * Create a new camera attached to a window.
      * @param[in] a_window Window on which to attach the new camera.
@@ -478,13 +721,15 @@ namespace hoops_luminate_bridge {
      * @param[in] a_windowWidth Parent window width.
      * @param[in] a_windowHeight Parent window height.
      * @param[in] a_cameraInfo Camera generic description.
+     * @param[in] a_region Part of the view mapped to the whole render image, nullptr for the full view.
      * @return RED_OK if success, otherwise error code.
      */
     RED_RC syncCameras(RED::Object* a_camera,
                        Handedness a_sceneHandedness,
                        int a_windowWidth,
                        int a_windowHeight,
-                       CameraInfo const& a_cameraInfo);
+                       CameraInfo const& a_cameraInfo,
+                       ScreenRegion const* a_region = nullptr);
 
     /**
      * Check and perform tracing call in a window.
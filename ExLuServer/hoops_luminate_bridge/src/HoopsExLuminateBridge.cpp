@@ -6,25 +6,73 @@
 #include <REDImageTools.h>
 #include <REDIMaterialController.h>
 #include <REDIMaterialControllerProperty.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
 
 #include <hoops_luminate_bridge/LuminateRCTest.h>
 
 namespace hoops_luminate_bridge {
     static double s_dUnit;
 
-	HoopsLuminateBridgeEx::HoopsLuminateBridgeEx()
+	HoopsLuminateBridgeEx::HoopsLuminateBridgeEx() :
+		m_pModelFile(nullptr),
+		m_pPrcIdMap(nullptr),
+		m_isSceneConverted(false),
+		m_floorUVScale(0.0),
+		m_floorMaterial(nullptr),
+		m_floorTexture(nullptr),
+		m_floorTextureHash(0),
+		m_floorHasTexture(false)
 	{
 
 	}
 
 	HoopsLuminateBridgeEx::~HoopsLuminateBridgeEx()
 	{
+		// The floor material outlives the scenes, it is released with the bridge
+		RED::Object* resmgr = RED::Factory::CreateInstance(CID_REDResourceManager);
+		RED::IResourceManager* iresmgr = resmgr->As<RED::IResourceManager>();
 
+		if (nullptr != m_floorMaterial)
+			iresmgr->DeleteMaterial(m_floorMaterial, iresmgr->GetState());
+
+		if (nullptr != m_floorTexture)
+			iresmgr->DeleteImage(m_floorTexture, iresmgr->GetState());
 	}
 
     void HoopsLuminateBridgeEx::saveCameraState() {  }
 
-    LuminateSceneInfoPtr HoopsLuminateBridgeEx::convertScene() { return convertExSceneToLuminate(m_pModelFile, m_pPrcIdMap); }
+    LuminateSceneInfoPtr HoopsLuminateBridgeEx::convertScene()
+    {
+        // Scene data identify the model and the conversion options it was extracted with
+        m_convertedSceneData = m_sceneData;
+        m_isSceneConverted = true;
+
+        // A scene built ahead of time is used once, the bridge owns it from now on
+        if (nullptr != m_prebuiltScene)
+        {
+            LuminateSceneInfoPtr sceneInfo = m_prebuiltScene;
+            m_prebuiltScene.reset();
+            return sceneInfo;
+        }
+
+        // Scenes already extracted, or read from the conversion cache, skip Exchange
+        if (nullptr != m_sceneData)
+            return buildLuminateScene(*m_sceneData);
+
+        return convertExSceneToLuminate(m_pModelFile, m_pPrcIdMap);
+    }
+
+    bool HoopsLuminateBridgeEx::isConvertedSceneCurrent() const
+    {
+        // A scene converted straight from Exchange cannot be identified
+        return nullptr != m_sceneData && m_sceneData == m_convertedSceneData && nullptr == m_prebuiltScene;
+    }
 
     bool HoopsLuminateBridgeEx::checkCameraChange()
     {
@@ -152,7 +200,7 @@ namespace hoops_luminate_bridge {
         return RED_RC();
     }
 
-    bool HoopsLuminateBridgeEx::addFloorMesh(const int pointCnt, const double* points, const int faceCnt, const int* faceList, const double* uvs)
+    bool HoopsLuminateBridgeEx::addFloorMesh(const int vertexCount, const float* points, const int triangleCount, const int* indices, const float* uvs)
     {
         ConversionContextNode* conversionDataNode = (ConversionContextNode*)m_conversionDataPtr.get();
         if (nullptr == conversionDataNode->rootTransformShape)
@@ -166,28 +214,25 @@ namespace hoops_luminate_bridge {
         RED::Object* mesh = RED::Factory::CreateInstance(CID_REDMeshShape);
         RED::IMeshShape* imesh = mesh->As<RED::IMeshShape>();
 
-        std::vector<float> fPoints(points, points + pointCnt);
-        RC_TEST(imesh->SetArray(RED::MCL_VERTEX, fPoints.data(), pointCnt / 3, 3, RED::MFT_FLOAT, iresmgr->GetState()));
-        std::vector<float>().swap(fPoints);
+        // Arrays are copied by the mesh, they are read straight from the caller buffers
+        RC_TEST(imesh->SetArray(RED::MCL_VERTEX, points, vertexCount, 3, RED::MFT_FLOAT, iresmgr->GetState()));
 
-        RC_TEST(imesh->AddTriangles(faceList, faceCnt, iresmgr->GetState()));
+        RC_TEST(imesh->AddTriangles(indices, triangleCount, iresmgr->GetState()));
 
-        std::vector<double> normals;
-        for (int i = 0; i < pointCnt / 3; i++)
-        {
-            normals.push_back(0.0);
-            normals.push_back(0.0);
-            normals.push_back(1.0);
-        }
-        RC_TEST(imesh->SetArray(RED::MCL_NORMAL, normals.data(), pointCnt / 3, 3, RED::MFT_FLOAT, iresmgr->GetState()));
-        std::vector<double>().swap(normals);
+        std::vector<float> normals(3 * vertexCount, 0.f);
+        for (int i = 0; i < vertexCount; i++)
+            normals[3 * i + 2] = 1.f;
+        RC_TEST(imesh->SetArray(RED::MCL_NORMAL, normals.data(), vertexCount, 3, RED::MFT_FLOAT, iresmgr->GetState()));
+        std::vector<float>().swap(normals);
 
         if (nullptr != uvs)
         {
-            std::vector<float>().swap(m_floorUVArr);
-            for (int i = 0; i < pointCnt / 3 * 2; i++)
-                m_floorUVArr.push_back((float)uvs[i]);
-            RC_TEST(imesh->SetArray(RED::MESH_CHANNEL::MCL_TEX0, m_floorUVArr.data(), pointCnt / 3, 2, RED::MFT_FLOAT, iresmgr->GetState()));
+            // Kept to be scaled by updateFloorMaterial
+            m_floorUVArr.assign(uvs, uvs + 2 * vertexCount);
+            RC_TEST(imesh->SetArray(RED::MESH_CHANNEL::MCL_TEX0, m_floorUVArr.data(), vertexCount, 2, RED::MFT_FLOAT, iresmgr->GetState()));
+
+            // The new mesh holds unscaled UVs
+            m_floorUVScale = 0.0;
         }
         else
         {
@@ -231,7 +276,83 @@ namespace hoops_luminate_bridge {
         return true;
     }
 
-    bool HoopsLuminateBridgeEx::updateFloorMaterial(const double* color, const char* texturePath, const double uvScale)
+    bool HoopsLuminateBridgeEx::setNodeMatrices(std::vector<std::string> const& a_nodeIds, const double* a_matrices)
+    {
+        // Before the first conversion the bridge holds an empty base scene
+        if (!m_isSceneConverted || nullptr == m_conversionDataPtr)
+            return false;
+
+        ConversionContextNode* conversionDataNode = (ConversionContextNode*)m_conversionDataPtr.get();
+
+        RED::Object* resmgr = RED::Factory::CreateInstance(CID_REDResourceManager);
+        RED::IResourceManager* iresmgr = resmgr->As<RED::IResourceManager>();
+
+        bool hasChanged = false;
+        for (size_t i = 0; i < a_nodeIds.size(); i++)
+        {
+            SegmentTransformShapeMap::iterator it = conversionDataNode->segmentTransformShapeMap.find(a_nodeIds[i]);
+            if (it == conversionDataNode->segmentTransformShapeMap.end())
+                continue;
+
+            RED::Matrix redMatrix = RED::Matrix::IDENTITY;
+            redMatrix.SetColumnMajorMatrix(a_matrices + 16 * i);
+
+            RC_CHECK(it->second->As<RED::ITransformShape>()->SetMatrix(&redMatrix, iresmgr->GetState()));
+            hasChanged = true;
+        }
+
+        // A single restart of the progressive refinement for the whole batch
+        if (hasChanged)
+            resetFrame();
+
+        return true;
+    }
+
+    bool HoopsLuminateBridgeEx::setNodesVisibility(std::vector<std::string> const& a_nodeIds, const int* a_visibilities)
+    {
+        if (!m_isSceneConverted || nullptr == m_conversionDataPtr)
+            return false;
+
+        ConversionContextNode* conversionDataNode = (ConversionContextNode*)m_conversionDataPtr.get();
+        if (nullptr == conversionDataNode->modelTransformShape)
+            return false;
+
+        RED::ITransformShape* imodelTransform = conversionDataNode->modelTransformShape->As<RED::ITransformShape>();
+
+        RED::Object* resmgr = RED::Factory::CreateInstance(CID_REDResourceManager);
+        RED::IResourceManager* iresmgr = resmgr->As<RED::IResourceManager>();
+
+        bool hasChanged = false;
+        for (size_t i = 0; i < a_nodeIds.size(); i++)
+        {
+            SegmentTransformShapeMap::iterator it = conversionDataNode->segmentTransformShapeMap.find(a_nodeIds[i]);
+            if (it == conversionDataNode->segmentTransformShapeMap.end())
+                continue;
+
+            RED::Object* transform = it->second;
+            bool isHidden = 0 < conversionDataNode->detachedShapes.count(transform);
+
+            if (0 != a_visibilities[i] && isHidden)
+            {
+                RC_CHECK(imodelTransform->AddChild(transform, RED_SHP_DAG_NO_UPDATE, iresmgr->GetState()));
+                conversionDataNode->detachedShapes.erase(transform);
+                hasChanged = true;
+            }
+            else if (0 == a_visibilities[i] && !isHidden)
+            {
+                RC_CHECK(imodelTransform->RemoveChild(transform, RED_SHP_DAG_NO_UPDATE, iresmgr->GetState()));
+                conversionDataNode->detachedShapes.insert(transform);
+                hasChanged = true;
+            }
+        }
+
+        if (hasChanged)
+            resetFrame();
+
+        return true;
+    }
+
+    bool HoopsLuminateBridgeEx::updateFloorMaterial(const double* color, const char* texturePath, const unsigned long long textureHash, const double uvScale)
     {
         ConversionContextNode* conversionDataNode = (ConversionContextNode*)m_conversionDataPtr.get();
         if (nullptr == conversionDataNode->floorMesh)
@@ -243,70 +364,104 @@ namespace hoops_luminate_bridge {
         RED::Object* resmgr = RED::Factory::CreateInstance(CID_REDResourceManager);
         RED::IResourceManager* iresmgr = resmgr->As<RED::IResourceManager>();
 
-        // Meterial
-        RED::Object* material = nullptr;
-        RC_TEST(iresmgr->CreateMaterial(material, iresmgr->GetState()));
-        RED::IMaterial* imaterial = material->As< RED::IMaterial >();
+        // The frame is restarted only when the floor changes
+        bool changed = false;
 
-        float fR = color[0];
-        float fG = color[1];
-        float fB = color[2];
-        float fA = color[3];
+        // Set UV scale, only when it changes
+        double scale = 0 < uvScale ? uvScale : 0.0;
+        if (m_floorUVArr.size() && scale != m_floorUVScale)
+        {
+            const float* uvArr = m_floorUVArr.data();
+            if (0 < scale)
+            {
+                m_floorScaledUVArr.resize(m_floorUVArr.size());
+                for (size_t i = 0; i < m_floorUVArr.size(); i++)
+                    m_floorScaledUVArr[i] = float(m_floorUVArr[i] * scale);
+                uvArr = m_floorScaledUVArr.data();
+            }
+            RC_TEST(imesh->SetArray(RED::MESH_CHANNEL::MCL_TEX0, uvArr, int(m_floorUVArr.size() / 2), 2, RED::MFT_FLOAT, iresmgr->GetState()));
+            m_floorUVScale = scale;
+            changed = true;
+        }
 
-        RED::Color deffuseColor = RED::Color(fR, fG, fB, 1.f);
-        RED::Color feflectionColor = RED::Color(0.25f, 0.25f, 0.25f, 1.f);
-        RED::Color anisotropyColor = RED::Color(0.25f, 0.25f, 0.25f, 1.f);
-        RED::Color transmissionColor = RED::Color(1.f - fA, 1.f - fA, 1.f - fA, 1.f - fA);
+        // Load texture, in the same image, only when its content changes
+        bool hasTexture = 0 < strlen(texturePath);
+        bool textureChanged = false;
+        if (hasTexture && (nullptr == m_floorTexture || textureHash != m_floorTextureHash)) {
+            if (nullptr == m_floorTexture)
+                RC_TEST(iresmgr->CreateImage2D(m_floorTexture, iresmgr->GetState()));
 
-        resetFrame();
+            RC_TEST(RED::ImageTools::Load(m_floorTexture, texturePath, RED::FMT_RGB, false, false, RED::TGT_TEX_2D, iresmgr->GetState()));
+            m_floorTextureHash = textureHash;
+            textureChanged = true;
+        }
 
-        // Set UV scale
-        if (m_floorUVArr.size() && 0 < uvScale)
+        // Material, set up again only when its parameters change
+        std::vector<double> floorColor(color, color + 4);
+        if (nullptr == m_floorMaterial || floorColor != m_floorColor || hasTexture != m_floorHasTexture || textureChanged)
         {
-            std::vector<float> uvArr;
-            for (int i = 0; i < m_floorUVArr.size(); i++)
-                uvArr.push_back(m_floorUVArr[i] * uvScale);
-            RC_TEST(imesh->SetArray(RED::MESH_CHANNEL::MCL_TEX0, uvArr.data(), int(uvArr.size() / 2), 2, RED::MFT_FLOAT, iresmgr->GetState()));
+            if (nullptr == m_floorMaterial)
+                RC_TEST(iresmgr->CreateMaterial(m_floorMaterial, iresmgr->GetState()));
+            RED::IMaterial* imaterial = m_floorMaterial->As< RED::IMaterial >();
+
+            float fR = color[0];
+            float fG = color[1];
+            float fB = color[2];
+            float fA = color[3];
+
+            RED::Color deffuseColor = RED::Color(fR, fG, fB, 1.f);
+            RED::Color feflectionColor = RED::Color(0.25f, 0.25f, 0.25f, 1.f);
+            RED::Color anisotropyColor = RED::Color(0.25f, 0.25f, 0.25f, 1.f);
+            RED::Color transmissionColor = RED::Color(1.f - fA, 1.f - fA, 1.f - fA, 1.f - fA);
+
+            RED::Object* texture = hasTexture ? m_floorTexture : NULL;
+
+            RC_TEST(imaterial->SetupRealisticMaterial(
+
+                false,                                                         // Double sided
+                true,                                                          // Fresnel
+                deffuseColor, texture, RED::Matrix::IDENTITY, RED::MCL_TEX0,   // Diffusion
+                feflectionColor, NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0, // Reflection
+                RED::Color::BLACK, FLT_MAX,                                    // Reflection fog
+                false, false, NULL, RED::Matrix::IDENTITY,                     // Environment
+                transmissionColor, NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0, // Transmission
+                0.0f, NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0,              // Transmission glossiness
+                2.3f, NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0,              // IOR
+                RED::Color::WHITE, 1.0f,                                       // Transmission scattering
+                false, false,                                                  // Caustics
+                anisotropyColor, NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0, // Reflection anisotropy
+                0.0f, NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0,              // Reflection anisotropy orientation
+                NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0, RED::MCL_USER0,    // Bump
+                0.0f, 0.0f, NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0,        // Displacement
+                NULL, &RED::LayerSet::ALL_LAYERS,                              // Layersets
+                resmgr, iresmgr->GetState()));
+
+            m_floorColor = floorColor;
+            m_floorHasTexture = hasTexture;
+            changed = true;
         }
 
-        // Load texture
-        RED::Object* texture = NULL;
-        if (strlen(texturePath)) {
-            // Load a texture:
-            RC_TEST(iresmgr->CreateImage2D(texture, iresmgr->GetState()));
-            RC_TEST(RED::ImageTools::Load(texture, texturePath, RED::FMT_RGB, false, false, RED::TGT_TEX_2D, iresmgr->GetState()));
-
+        // A new floor mesh gets the existing material
+        RED::Object* currentMaterial = nullptr;
+        floorMesh->As<RED::IShape>()->GetMaterial(currentMaterial);
+        if (currentMaterial != m_floorMaterial) {
+            RC_TEST(floorMesh->As<RED::IShape>()->SetMaterial(m_floorMaterial, iresmgr->GetState()));
+            changed = true;
         }
 
-        RC_TEST(imaterial->SetupRealisticMaterial(
-
-            false,                                                         // Double sided
-            true,                                                          // Fresnel
-            deffuseColor, texture, RED::Matrix::IDENTITY, RED::MCL_TEX0,   // Diffusion
-            feflectionColor, NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0, // Reflection
-            RED::Color::BLACK, FLT_MAX,                                    // Reflection fog
-            false, false, NULL, RED::Matrix::IDENTITY,                     // Environment
-            transmissionColor, NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0, // Transmission
-            0.0f, NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0,              // Transmission glossiness
-            2.3f, NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0,              // IOR
-            RED::Color::WHITE, 1.0f,                                       // Transmission scattering
-            false, false,                                                  // Caustics
-            anisotropyColor, NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0, // Reflection anisotropy
-            0.0f, NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0,              // Reflection anisotropy orientation
-            NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0, RED::MCL_USER0,    // Bump
-            0.0f, 0.0f, NULL, RED::Matrix::IDENTITY, RED::MCL_TEX0,        // Displacement
-            NULL, &RED::LayerSet::ALL_LAYERS,                              // Layersets
-            resmgr, iresmgr->GetState()));
-
-        // Apply material if any.
-        if (material != nullptr)
-        {
-            RC_TEST(floorMesh->As<RED::IShape>()->SetMaterial(material, iresmgr->GetState()));
+        if (changed)
+            resetFrame();
+
+        return true;
+    }
 
+    bool HoopsLuminateBridgeEx::isFloorImageUpdateRequired(const char* texturePath, const unsigned long long textureHash) const
+    {
+        // The first material setup creates images too
+        if (nullptr == m_floorMaterial)
             return true;
-        }
 
-        return false;
+        return 0 < strlen(texturePath) && (nullptr == m_floorTexture || textureHash != m_floorTextureHash);
     }
 
     RED::Object* HoopsLuminateBridgeEx::getFloorMesh()
@@ -424,39 +579,31 @@ namespace hoops_luminate_bridge {
         return materialInfo;
     }
 
-    RED::Object* convertExMeshToREDMeshShape(const RED::State& a_state, A3DMeshData a_meshData)
+    void buildExMeshBuffers(A3DMeshData const& a_meshData, ExMeshBuffers& a_outBuffers)
     {
-        RED_RC rc;
-
-        RED::Object* result = RED::Factory::CreateInstance(CID_REDMeshShape);
-        RED::IMeshShape* imesh = result->As<RED::IMeshShape>();
+        a_outBuffers.points.assign(a_meshData.m_pdCoords, a_meshData.m_pdCoords + a_meshData.m_uiCoordSize);
+        a_outBuffers.normals.assign(a_meshData.m_pdNormals, a_meshData.m_pdNormals + a_meshData.m_uiNormalSize);
 
-        std::vector<float> points(a_meshData.m_pdCoords, a_meshData.m_pdCoords + a_meshData.m_uiCoordSize);
+        size_t indexCount = 0;
+        for (A3DUns32 i = 0; i < a_meshData.m_uiFaceSize; i++)
+            indexCount += a_meshData.m_puiTriangleCountPerFace[i] * 3;
 
-        rc = imesh->SetArray(RED::MCL_VERTEX, points.data(), a_meshData.m_uiCoordSize / 3, 3, RED::MFT_FLOAT, a_state);
-
-        std::vector<float>().swap(points);
+        a_outBuffers.indices.assign(a_meshData.m_puiVertexIndicesPerFace, a_meshData.m_puiVertexIndicesPerFace + indexCount);
+        a_outBuffers.triangleCount = int(indexCount / 3);
+    }
 
-        int triangleCount = 0;
-        RED::Vector<int> indices;
-        int cnt = 0;
-        for (int i = 0; i < a_meshData.m_uiFaceSize; i++)
-        {
-            int faceCnt = a_meshData.m_puiTriangleCountPerFace[i];
-            triangleCount += faceCnt;
-            for (int j = 0; j < faceCnt * 3; j++)
-            {
-                indices.push_back(a_meshData.m_puiVertexIndicesPerFace[cnt++]);
-            }
-        }
+    RED::Object* createREDMeshShape(const RED::State& a_state, ExMeshBuffers const& a_buffers)
+    {
+        RED_RC rc;
 
-        rc = imesh->AddTriangles(&indices[0], triangleCount, a_state);
+        RED::Object* result = RED::Factory::CreateInstance(CID_REDMeshShape);
+        RED::IMeshShape* imesh = result->As<RED::IMeshShape>();
 
-        std::vector<float> normols(a_meshData.m_pdNormals, a_meshData.m_pdNormals + a_meshData.m_uiNormalSize);
+        rc = imesh->SetArray(RED::MCL_VERTEX, a_buffers.points.data(), int(a_buffers.points.size() / 3), 3, RED::MFT_FLOAT, a_state);
 
-        rc = imesh->SetArray(RED::MCL_NORMAL, normols.data(), a_meshData.m_uiNormalSize / 3, 3, RED::MFT_FLOAT, a_state);
+        rc = imesh->AddTriangles(a_buffers.indices.data(), a_buffers.triangleCount, a_state);
 
-        std::vector<float>().swap(normols);
+        rc = imesh->SetArray(RED::MCL_NORMAL, a_buffers.normals.data(), int(a_buffers.normals.size() / 3), 3, RED::MFT_FLOAT, a_state);
 
         // Luminate need UV coordinates so we will build them
         rc = imesh->BuildTextureCoordinates(RED::MESH_CHANNEL::MCL_TEX0, RED::MTCM_BOX, RED::Matrix::IDENTITY, a_state);
@@ -470,13 +617,9 @@ namespace hoops_luminate_bridge {
         return result;
     }
 
-    void traverseTreeNode(RED::Object* a_resmgr, ConversionContextNode& a_ioConversionContext, 
-        A3DTree* const hnd_tree, A3DTreeNode* const hnd_node, A3DMiscCascadedAttributes* pParentAttr, A3DPrcIdMap* a_pMap, RED::Object* modelTransformShape)
+    void collectTreeNode(ExSceneData& a_ioSceneData, std::map<A3DEntity*, int>& a_ioMeshIndexMap,
+        A3DTree* const hnd_tree, A3DTreeNode* const hnd_node, A3DMiscCascadedAttributes* pParentAttr, A3DPrcIdMap* a_pMap)
     {
-        RED_RC rc;
-        RED::IResourceManager* iresmgr = a_resmgr->As<RED::IResourceManager>();
-        RED::ITransformShape* iModelTransform = modelTransformShape->As<RED::ITransformShape>();
-
         A3DStatus iRet;
         // Get node net matrix
         A3DMiscTransformation* transf;
@@ -507,14 +650,24 @@ namespace hoops_luminate_bridge {
             }
             else if (0 == strcmp(pTypeMsg, "kA3DTypeRiBrepModel") || 0 == strcmp(pTypeMsg, "kA3DTypeRiPolyBrepModel"))
             {
-                // Get node mesh
-                A3DMeshData meshData;
-                A3D_INITIALIZE_DATA(A3DMeshData, meshData);
-                if (A3D_SUCCESS != A3DRiComputeMesh(pEntity, pParentAttr, &meshData, nullptr))
-                    return;
+                // Representation items shared by several occurrences (e.g. fasteners) are tessellated
+                // only once: the resulting mesh shape is instanced under each occurrence transform.
+                std::map<A3DEntity*, int>::iterator meshIt = a_ioMeshIndexMap.find(pEntity);
+                int meshIndex;
+                if (meshIt != a_ioMeshIndexMap.end())
+                {
+                    meshIndex = meshIt->second;
+                }
+                else
+                {
+                    meshIndex = int(a_ioSceneData.meshes.size());
+                    a_ioMeshIndexMap[pEntity] = meshIndex;
 
-                if (0 == meshData.m_uiCoordSize || 0 == meshData.m_uiFaceSize)
-                    return;
+                    ExMeshBuffers meshBuffers;
+                    meshBuffers.riEntity = pEntity;
+                    meshBuffers.cascadedAttributes = pParentAttr;
+                    a_ioSceneData.meshes.push_back(meshBuffers);
+                }
 
                 // Get PRC ID
                 A3DTreeNode* parent_node;
@@ -526,90 +679,184 @@ namespace hoops_luminate_bridge {
                 A3DPrcId prcId;
                 iRet = A3DPrcIdMapFindId(a_pMap, pEntity, pParentEntity, &prcId);
 
-                A3DGraphRgbColorData sColor;
+                ExNodeInstance node;
+                node.prcId = prcId;
+                node.meshIndex = meshIndex;
+                std::copy(matrix, matrix + 16, node.matrix);
+
+                A3D_INITIALIZE_DATA(A3DGraphRgbColorData, node.color);
                 A3DUns32 uiColorIndex = styleData.m_uiRgbColorIndex;
                 if (A3D_DEFAULT_STYLE_INDEX != uiColorIndex)
-                {
-                    A3D_INITIALIZE_DATA(A3DGraphRgbColorData, sColor);
-                    A3DGlobalGetGraphRgbColorData(uiColorIndex, &sColor);
-                }
+                    A3DGlobalGetGraphRgbColorData(uiColorIndex, &node.color);
+
+                a_ioSceneData.nodes.push_back(node);
 
-                // Create Luminate matrix
-                RED::Matrix redMatrix = RED::Matrix::IDENTITY;
-                redMatrix.SetColumnMajorMatrix(matrix);
+                A3DTreeNodeGetEntity(nullptr, &pParentEntity);
+                A3DTreeNodeGetParent(nullptr, nullptr, &parent_node);
+            }
 
-                // Create Luminate material
-                RED::Object* material = nullptr;
-                std::vector<RED::Object*> meshShapes;
+            // Get child nodes
+            A3DUns32 n_child_nodes = 0;
+            A3DTreeNode** child_nodes = nullptr;
+            iRet = A3DTreeNodeGetChildren(hnd_tree, hnd_node, &n_child_nodes, &child_nodes);
 
-                RealisticMaterialInfo materialInfo = getSegmentMaterialInfo(sColor,
-                    a_resmgr,
-                    a_ioConversionContext.defaultMaterialInfo,
-                    a_ioConversionContext.imageNameToLuminateMap,
-                    a_ioConversionContext.textureNameImageNameMap,
-                    a_ioConversionContext.pbrToRealisticConversionMap);
+            for (A3DUns32 n = 0; n < n_child_nodes; ++n)
+            {
+                collectTreeNode(a_ioSceneData, a_ioMeshIndexMap, hnd_tree, child_nodes[n], pAttr, a_pMap);
+            }
+            A3DTreeNodeGetChildren(0, 0, &n_child_nodes, &child_nodes);
+        }
+    }
 
-                material = createREDMaterial(materialInfo,
-                    a_resmgr,
-                    a_ioConversionContext.imageNameToLuminateMap,
-                    a_ioConversionContext.textureNameImageNameMap,
-                    a_ioConversionContext.materials);
+    void computeExMeshBuffers(ExSceneData& a_ioSceneData)
+    {
+        //////////////////////////////////////////
+        // Exchange calls are not thread safe, they
+        // stay on the calling thread: it tessellates
+        // each item in turn and hands the Exchange
+        // mesh over to workers which build the float
+        // and index buffers meanwhile. Built meshes
+        // are released back on the calling thread.
+        //////////////////////////////////////////
 
-                RED::Object* shape = nullptr;
-                shape = convertExMeshToREDMeshShape(iresmgr->GetState(), meshData);
+        int meshCount = int(a_ioSceneData.meshes.size());
+        unsigned int coreCount = std::thread::hardware_concurrency();
+        int workerCount = std::min(meshCount - 1, 1 < coreCount ? int(coreCount) - 1 : 0);
 
-                if (shape != nullptr)
-                    meshShapes.push_back(shape);
+        std::mutex queueMutex;
+        std::condition_variable queueCondition;
+        std::deque<std::pair<int, A3DMeshData>> pendingMeshes;
+        std::vector<A3DMeshData> builtMeshes;
+        bool allMeshesQueued = false;
 
-                //////////////////////////////////////////
-                // Create RED transform shape associated to segment
-                //////////////////////////////////////////
+        std::vector<std::thread> workers;
+        for (int w = 0; w < workerCount; w++)
+        {
+            workers.push_back(std::thread([&]() {
+                for (;;)
+                {
+                    std::pair<int, A3DMeshData> job;
+                    {
+                        std::unique_lock<std::mutex> lock(queueMutex);
+                        queueCondition.wait(lock, [&]() { return !pendingMeshes.empty() || allMeshesQueued; });
 
-                RED::Object* transform = RED::Factory::CreateInstance(CID_REDTransformShape);
-                RED::ITransformShape* itransform = transform->As<RED::ITransformShape>();
+                        if (pendingMeshes.empty())
+                            return;
 
-                // Register transform shape associated to the segment.
-                a_ioConversionContext.segmentTransformShapeMap[prcId] = transform;
+                        job = pendingMeshes.front();
+                        pendingMeshes.pop_front();
+                    }
 
-                // DiffuseColor color.
-                RED::Color deffuseColor = RED::Color(float(sColor.m_dRed), float(sColor.m_dGreen), float(sColor.m_dBlue), 1.f);
-                a_ioConversionContext.nodeDiffuseColorMap[prcId] = deffuseColor;
+                    buildExMeshBuffers(job.second, a_ioSceneData.meshes[job.first]);
 
-                transform->SetID(prcId);
+                    std::lock_guard<std::mutex> lock(queueMutex);
+                    builtMeshes.push_back(job.second);
+                }
+            }));
+        }
 
-                // Apply transform matrix.
-                RC_CHECK(itransform->SetMatrix(&redMatrix, iresmgr->GetState()));
+        // Release the Exchange mesh data of already built items
+        auto releaseBuiltMeshes = [&]() {
+            std::vector<A3DMeshData> toRelease;
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                toRelease.swap(builtMeshes);
+            }
+            for (A3DMeshData& meshData : toRelease)
+                A3DRiComputeMesh(nullptr, nullptr, &meshData, nullptr);
+        };
 
-                // Apply material if any.
-                if (material != nullptr)
-                    RC_CHECK(transform->As<RED::IShape>()->SetMaterial(material, iresmgr->GetState()));
+        for (int i = 0; i < meshCount; i++)
+        {
+            ExMeshBuffers& meshBuffers = a_ioSceneData.meshes[i];
 
-                // Add geometry shapes if any.
-                for (RED::Object* meshShape : meshShapes)
-                    RC_CHECK(itransform->AddChild(meshShape, RED_SHP_DAG_NO_UPDATE, iresmgr->GetState()));
+            // The model file is deleted once extracted, its entities must not be kept
+            A3DEntity* riEntity = meshBuffers.riEntity;
+            A3DMiscCascadedAttributes* cascadedAttributes = meshBuffers.cascadedAttributes;
+            meshBuffers.riEntity = nullptr;
+            meshBuffers.cascadedAttributes = nullptr;
 
-                iModelTransform->AddChild(transform, RED_SHP_DAG_NO_UPDATE, iresmgr->GetState());
+            A3DMeshData meshData;
+            A3D_INITIALIZE_DATA(A3DMeshData, meshData);
+            if (A3D_SUCCESS != A3DRiComputeMesh(riEntity, cascadedAttributes, &meshData, nullptr))
+                continue;
 
+            if (0 == meshData.m_uiCoordSize || 0 == meshData.m_uiFaceSize)
+            {
                 A3DRiComputeMesh(nullptr, nullptr, &meshData, nullptr);
-                A3DTreeNodeGetEntity(nullptr, &pParentEntity);
-                A3DTreeNodeGetParent(nullptr, nullptr, &parent_node);
-
+                continue;
             }
 
-            // Get child nodes
-            A3DUns32 n_child_nodes = 0;
-            A3DTreeNode** child_nodes = nullptr;
-            iRet = A3DTreeNodeGetChildren(hnd_tree, hnd_node, &n_child_nodes, &child_nodes);
+            // Without workers, e.g. a single item, the buffers are built right away
+            if (workers.empty())
+            {
+                buildExMeshBuffers(meshData, meshBuffers);
+                A3DRiComputeMesh(nullptr, nullptr, &meshData, nullptr);
+                continue;
+            }
 
-            for (A3DUns32 n = 0; n < n_child_nodes; ++n)
             {
-                traverseTreeNode(a_resmgr, a_ioConversionContext, hnd_tree, child_nodes[n], pAttr, a_pMap, modelTransformShape);
+                std::lock_guard<std::mutex> lock(queueMutex);
+                pendingMeshes.push_back(std::make_pair(i, meshData));
             }
-            A3DTreeNodeGetChildren(0, 0, &n_child_nodes, &child_nodes);
+            queueCondition.notify_one();
+
+            releaseBuiltMeshes();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            allMeshesQueued = true;
         }
+        queueCondition.notify_all();
+
+        for (std::thread& worker : workers)
+            worker.join();
+
+        releaseBuiltMeshes();
     }
 
-    LuminateSceneInfoPtr convertExSceneToLuminate(A3DAsmModelFile* pModelFile, A3DEntity* pMap)
+    ExSceneDataPtr extractExScene(A3DAsmModelFile* pModelFile, A3DEntity* pMap)
+    {
+        ExSceneDataPtr sceneDataPtr = std::make_shared<ExSceneData>();
+
+        A3DStatus iRet;
+        // Get unit
+        A3DAsmModelFileData sData;
+        A3D_INITIALIZE_DATA(A3DAsmModelFileData, sData);
+        A3DAsmModelFileGet(pModelFile, &sData);
+        s_dUnit = sData.m_dUnit;
+
+        //////////////////////////////////////////
+        // First pass: collect representation items
+        // with their net transforms and styles.
+        //////////////////////////////////////////
+
+        A3DTree* tree = 0;
+        iRet = A3DTreeCompute(pModelFile, &tree, 0);
+
+        A3DTreeNode* root_node = 0;
+        iRet = A3DTreeGetRootNode(tree, &root_node);
+
+        A3DMiscCascadedAttributes* pAttr;
+        A3DMiscCascadedAttributesCreate(&pAttr);
+
+        std::map<A3DEntity*, int> meshIndexMap;
+        collectTreeNode(*sceneDataPtr, meshIndexMap, tree, root_node, pAttr, (A3DPrcIdMap*)pMap);
+
+        iRet = A3DTreeCompute(nullptr, &tree, nullptr);
+
+        //////////////////////////////////////////
+        // Second pass: extract meshes and build
+        // float/index buffers on worker threads.
+        //////////////////////////////////////////
+
+        computeExMeshBuffers(*sceneDataPtr);
+
+        return sceneDataPtr;
+    }
+
+    LuminateSceneInfoPtr buildLuminateScene(ExSceneData const& a_sceneData)
     {
         //////////////////////////////////////////
         // Get the resource manager singleton.
@@ -661,31 +908,217 @@ namespace hoops_luminate_bridge {
         sceneInfoPtr->viewHandedness = viewHandedness;
 
         //////////////////////////////////////////
-        // Proceed with node tree traversal to convert scene
+        // Final pass: create RED mesh shapes once per
+        // representation item, then a transform shape
+        // per occurrence instancing them.
         //////////////////////////////////////////
 
-        A3DStatus iRet;
-        // Get unit
-        A3DAsmModelFileData sData;
-        A3D_INITIALIZE_DATA(A3DAsmModelFileData, sData);
-        A3DAsmModelFileGet(pModelFile, &sData);
-        s_dUnit = sData.m_dUnit;
+        for (int meshIndex = 0; meshIndex < int(a_sceneData.meshes.size()); meshIndex++)
+        {
+            ExMeshBuffers const& meshBuffers = a_sceneData.meshes[meshIndex];
 
-        // Traverse model
-        A3DTree* tree = 0;
-        iRet = A3DTreeCompute(pModelFile, &tree, 0);
+            std::vector<RED::Object*> meshShapes;
+            if (0 < meshBuffers.triangleCount)
+            {
+                RED::Object* shape = createREDMeshShape(iresourceManager->GetState(), meshBuffers);
+                if (shape != nullptr)
+                    meshShapes.push_back(shape);
+            }
+            sceneInfoPtr->segmentMeshShapesMap[(intptr_t)meshIndex] = meshShapes;
+        }
 
-        A3DTreeNode* root_node = 0;
-        iRet = A3DTreeGetRootNode(tree, &root_node);
+        for (ExNodeInstance const& node : a_sceneData.nodes)
+        {
+            std::vector<RED::Object*> const& meshShapes =
+                sceneInfoPtr->segmentMeshShapesMap[(intptr_t)node.meshIndex];
 
-        A3DMiscCascadedAttributes* pAttr;
-        A3DMiscCascadedAttributesCreate(&pAttr);
-        
-        traverseTreeNode(resourceManager, *sceneInfoPtr, tree, root_node, pAttr, (A3DPrcIdMap*)pMap, modelTransformShape);
+            if (meshShapes.empty())
+                continue;
 
-        iRet = A3DTreeCompute(nullptr, &tree, nullptr);
+            // Create Luminate matrix
+            RED::Matrix redMatrix = RED::Matrix::IDENTITY;
+            redMatrix.SetColumnMajorMatrix(node.matrix);
+
+            // Create Luminate material
+            RealisticMaterialInfo materialInfo = getSegmentMaterialInfo(node.color,
+                resourceManager,
+                sceneInfoPtr->defaultMaterialInfo,
+                sceneInfoPtr->imageNameToLuminateMap,
+                sceneInfoPtr->textureNameImageNameMap,
+                sceneInfoPtr->pbrToRealisticConversionMap);
+
+            RED::Object* material = createREDMaterial(materialInfo,
+                resourceManager,
+                sceneInfoPtr->imageNameToLuminateMap,
+                sceneInfoPtr->textureNameImageNameMap,
+                sceneInfoPtr->materials);
+
+            //////////////////////////////////////////
+            // Create RED transform shape associated to segment
+            //////////////////////////////////////////
+
+            RED::Object* transform = RED::Factory::CreateInstance(CID_REDTransformShape);
+            RED::ITransformShape* itransform = transform->As<RED::ITransformShape>();
+
+            // Register transform shape associated to the segment.
+            sceneInfoPtr->segmentTransformShapeMap[node.prcId] = transform;
+
+            // DiffuseColor color.
+            RED::Color deffuseColor = RED::Color(float(node.color.m_dRed), float(node.color.m_dGreen), float(node.color.m_dBlue), 1.f);
+            sceneInfoPtr->nodeDiffuseColorMap[node.prcId] = deffuseColor;
+
+            transform->SetID(node.prcId.c_str());
+
+            // Apply transform matrix.
+            RC_CHECK(itransform->SetMatrix(&redMatrix, iresourceManager->GetState()));
+
+            // Apply material if any.
+            if (material != nullptr)
+                RC_CHECK(transform->As<RED::IShape>()->SetMaterial(material, iresourceManager->GetState()));
+
+            // Add geometry shapes if any.
+            for (RED::Object* meshShape : meshShapes)
+                RC_CHECK(itransform->AddChild(meshShape, RED_SHP_DAG_NO_UPDATE, iresourceManager->GetState()));
+
+            iModelTransform->AddChild(transform, RED_SHP_DAG_NO_UPDATE, iresourceManager->GetState());
+        }
 
         return sceneInfoPtr;
     }
 
-}
\ No newline at end of file
+    //////////////////////////////////////////
+    // Scene files: a header, the mesh buffers,
+    // then the node instances referencing them.
+    //////////////////////////////////////////
+
+    static const char s_exSceneMagic[4] = { 'E', 'X', 'S', 'C' };
+    static const int s_exSceneVersion = 1;
+
+    template <typename T>
+    void writeExValue(std::ofstream& a_stream, T const& a_value)
+    {
+        a_stream.write((const char*)&a_value, sizeof(T));
+    }
+
+    template <typename T>
+    void writeExArray(std::ofstream& a_stream, std::vector<T> const& a_values)
+    {
+        writeExValue(a_stream, (unsigned long long)a_values.size());
+        if (!a_values.empty())
+            a_stream.write((const char*)a_values.data(), a_values.size() * sizeof(T));
+    }
+
+    template <typename T>
+    bool readExValue(std::ifstream& a_stream, T& a_value)
+    {
+        return (bool)a_stream.read((char*)&a_value, sizeof(T));
+    }
+
+    template <typename T>
+    bool readExArray(std::ifstream& a_stream, std::vector<T>& a_values)
+    {
+        unsigned long long size = 0;
+        if (!readExValue(a_stream, size) || size > (1ull << 32))
+            return false;
+
+        a_values.resize((size_t)size);
+        if (0 == size)
+            return true;
+        return (bool)a_stream.read((char*)a_values.data(), a_values.size() * sizeof(T));
+    }
+
+    bool writeExScene(ExSceneData const& a_sceneData, std::string const& a_filepath)
+    {
+        std::ofstream stream(a_filepath.c_str(), std::ios::binary);
+        if (!stream)
+            return false;
+
+        stream.write(s_exSceneMagic, sizeof(s_exSceneMagic));
+        writeExValue(stream, s_exSceneVersion);
+
+        writeExValue(stream, (unsigned long long)a_sceneData.meshes.size());
+        for (ExMeshBuffers const& meshBuffers : a_sceneData.meshes)
+        {
+            writeExArray(stream, meshBuffers.points);
+            writeExArray(stream, meshBuffers.normals);
+            writeExArray(stream, meshBuffers.indices);
+            writeExValue(stream, meshBuffers.triangleCount);
+        }
+
+        writeExValue(stream, (unsigned long long)a_sceneData.nodes.size());
+        for (ExNodeInstance const& node : a_sceneData.nodes)
+        {
+            writeExArray(stream, std::vector<char>(node.prcId.begin(), node.prcId.end()));
+            stream.write((const char*)node.matrix, sizeof(node.matrix));
+            writeExValue(stream, node.color.m_dRed);
+            writeExValue(stream, node.color.m_dGreen);
+            writeExValue(stream, node.color.m_dBlue);
+            writeExValue(stream, node.meshIndex);
+        }
+
+        return (bool)stream;
+    }
+
+    ExSceneDataPtr readExScene(std::string const& a_filepath)
+    {
+        std::ifstream stream(a_filepath.c_str(), std::ios::binary);
+        if (!stream)
+            return nullptr;
+
+        char magic[4];
+        int version = 0;
+        if (!stream.read(magic, sizeof(magic)) || 0 != memcmp(magic, s_exSceneMagic, sizeof(magic)) ||
+            !readExValue(stream, version) || s_exSceneVersion != version)
+            return nullptr;
+
+        ExSceneDataPtr sceneDataPtr = std::make_shared<ExSceneData>();
+
+        unsigned long long meshCount = 0;
+        if (!readExValue(stream, meshCount) || meshCount > (1ull << 32))
+            return nullptr;
+
+        sceneDataPtr->meshes.resize((size_t)meshCount);
+        for (ExMeshBuffers& meshBuffers : sceneDataPtr->meshes)
+        {
+            if (!readExArray(stream, meshBuffers.points) ||
+                !readExArray(stream, meshBuffers.normals) ||
+                !readExArray(stream, meshBuffers.indices) ||
+                !readExValue(stream, meshBuffers.triangleCount))
+                return nullptr;
+        }
+
+        unsigned long long nodeCount = 0;
+        if (!readExValue(stream, nodeCount) || nodeCount > (1ull << 32))
+            return nullptr;
+
+        sceneDataPtr->nodes.resize((size_t)nodeCount);
+        for (ExNodeInstance& node : sceneDataPtr->nodes)
+        {
+            std::vector<char> prcId;
+            if (!readExArray(stream, prcId))
+                return nullptr;
+            node.prcId.assign(prcId.begin(), prcId.end());
+
+            A3D_INITIALIZE_DATA(A3DGraphRgbColorData, node.color);
+            if (!stream.read((char*)node.matrix, sizeof(node.matrix)) ||
+                !readExValue(stream, node.color.m_dRed) ||
+                !readExValue(stream, node.color.m_dGreen) ||
+                !readExValue(stream, node.color.m_dBlue) ||
+                !readExValue(stream, node.meshIndex))
+                return nullptr;
+
+            if (0 > node.meshIndex || node.meshIndex >= int(sceneDataPtr->meshes.size()))
+                return nullptr;
+        }
+
+        return sceneDataPtr;
+    }
+
+    LuminateSceneInfoPtr convertExSceneToLuminate(A3DAsmModelFile* pModelFile, A3DEntity* pMap)
+    {
+        ExSceneDataPtr sceneDataPtr = extractExScene(pModelFile, pMap);
+
+        return buildLuminateScene(*sceneDataPtr);
+    }
+
+}
@@ -1,6 +1,7 @@
 #define NOMINMAX
 #include <cmath>
 #include <algorithm>
+#include <cstring>
 
 #include <REDILicense.h>
 #include <REDFactory.h>
@@ -13,6 +14,7 @@
 #include <REDIWindow.h>
 #include <REDIViewpoint.h>
 #include <REDIViewpointRenderList.h>
+#include <REDIImage2D.h>
 #include <REDIREDFile.h>
 #include <REDVector3.h>
 #include <REDMatrix.h>
@@ -34,11 +36,27 @@ namespace hoops_luminate_bridge {
     const RED::Matrix HoopsLuminateBridge::s_leftHandedToRightHandedMatrix =
         RED::Matrix(RED::Vector3(1, 0, 0), RED::Vector3(0, 0, 1), RED::Vector3(0, 1, 0), RED::Vector3(0, 0, 0));
 
+    // Luminate runtime state shared by every window of the process.
+    static bool s_luminateIsInitialized = false;
+    static int s_rayMaxThreadCount = 0;
+    static bool s_sharedLightingModelsCreated = false;
+
+    // Early convergence reads the render image back every few passes only, and compares one tile in four.
+    static const int s_noisePassInterval = 4;
+    static const int s_noiseTileSize = 32;
+    static DefaultLightingModel s_sharedDefaultLightingModel;
+    static PhysicalSunSkyLightingModel s_sharedSunSkyLightingModel;
+
     HoopsLuminateBridge::HoopsLuminateBridge():
         m_window(nullptr), m_frameIsComplete(false), m_newFrameIsRequired(true), m_axisTriad(), m_bSyncCamera(false),
         m_lightingModel(LightingModel::No), m_windowWidth(0), m_windowHeight(0), m_defaultLightingModel(),
         m_sunSkyLightingModel(), m_environmentMapLightingModel(), m_frameTracingMode(RED::FTF_PATH_TRACING),
-        m_selectedSegmentTransformIsDirty(false), m_rootTransformIsDirty(false)
+        m_selectedSegmentTransformIsDirty(false), m_rootTransformIsDirty(false), m_lastFrameStatistics(),
+        m_softAntiAlias(20), m_isInteractive(false), m_interactiveScale(2), m_interactiveDelayMilliseconds(300),
+        m_lastCameraSync(), m_frameBudgetMilliseconds(0), m_frameBudgetPasses(0), m_frameStart(),
+        m_lastTracedPass(-1), m_convergenceThreshold(0.002f), m_convergenceMinPasses(3), m_quietPassCount(0),
+        m_previousPassPixels(), m_hasRegionOfInterest(false), m_regionOfInterest(), m_regionDensity(1),
+        m_regionBackground()
     {
     }
 
@@ -64,19 +82,12 @@ namespace hoops_luminate_bridge {
         //saveCameraState();
 
         //////////////////////////////////////////
-        // Assign Luminate license.
-        //////////////////////////////////////////
-
-        bool licenseIsActive;
-        RED_RC rc = setLicense(a_license.c_str(), licenseIsActive);
-        if (rc != RED_OK || !licenseIsActive)
-            return false;
-
-        //////////////////////////////////////////
-        // Select Luminate rendering mode.
+        // Assign Luminate license, select rendering
+        // mode and set global rendering options.
+        // Done once for all the windows.
         //////////////////////////////////////////
 
-        rc = setSoftTracerMode(1);
+        RED_RC rc = initializeLuminate(a_license);
         if (rc != RED_OK)
             return false;
 
@@ -86,36 +97,7 @@ namespace hoops_luminate_bridge {
 
         RED::Object* resourceManager = RED::Factory::CreateInstance(CID_REDResourceManager);
         RED::IResourceManager* iresourceManager = resourceManager->As<RED::IResourceManager>();
-
-        //////////////////////////////////////////
-        // Set global rendering options.
-        //////////////////////////////////////////
-
         RED::IOptions* ioptions = resourceManager->As<RED::IOptions>();
-        RC_CHECK(ioptions->SetOptionValue(RED::OPTIONS_RAY_USE_EMBREE, true, iresourceManager->GetState()));
-
-        // Enable raytracer.
-        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_PRIMARY, true, iresourceManager->GetState()));
-
-        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_TONE_MAPPING_IGNORE_BACKGROUND, false, iresourceManager->GetState()));
-
-        // Set raytracing only options
-        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_GI, true, iresourceManager->GetState()));
-        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_GI_CACHE_PASSES_COUNT, 3, iresourceManager->GetState()));
-        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_SHADOWS, 3, iresourceManager->GetState()));
-        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_REFLECTIONS, 3, iresourceManager->GetState()));
-        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_REFRACTIONS, 3, iresourceManager->GetState()));
-        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_TRANSPARENCY, 3, iresourceManager->GetState()));
-
-        // Set pathtracing only options
-        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_PATH_GI, 3, iresourceManager->GetState()));
-
-        // We have the main thread and Vis uses some threads too.
-        // The main thread is preserved by Luminate itself.
-        // Limit the number of threads used by the soft tracer to preserve some interactivity.
-        int coreCount = iresourceManager->GetNumberOfProcessors();
-        int rayMaxThreadCount = std::max(1, coreCount - 2);
-        RC_CHECK(ioptions->SetOptionValue(RED::OPTIONS_RAY_MAX_THREADS, rayMaxThreadCount, iresourceManager->GetState()));
 
         //////////////////////////////////////////
         // Create a Luminate window.
@@ -155,7 +137,7 @@ namespace hoops_luminate_bridge {
         rc = iwindow->CreateVRL(auxvrl, a_windowWidth, a_windowHeight, RED::FMT_RGBA, true, iresourceManager->GetState());
 
         RED::IViewpointRenderList* iauxvrl = auxvrl->As<RED::IViewpointRenderList>();
-        RC_CHECK(iauxvrl->SetSoftAntiAlias(20, iresourceManager->GetState()));
+        RC_CHECK(iauxvrl->SetSoftAntiAlias(m_softAntiAlias, iresourceManager->GetState()));
 
         //////////////////////////////////////////
         // Create and initialize Luminate camera.
@@ -197,8 +179,13 @@ namespace hoops_luminate_bridge {
         // If the scene is initialy empty, we do not
         // need to add it anywhere.
         //////////////////////////////////////////
-        rc = createDefaultModel(m_defaultLightingModel);
-        rc = createPhysicalSunSkyModel(m_sunSkyLightingModel);
+        if (!s_sharedLightingModelsCreated) {
+            rc = createDefaultModel(s_sharedDefaultLightingModel);
+            rc = createPhysicalSunSkyModel(s_sharedSunSkyLightingModel);
+            s_sharedLightingModelsCreated = true;
+        }
+        m_defaultLightingModel = s_sharedDefaultLightingModel;
+        m_sunSkyLightingModel = s_sharedSunSkyLightingModel;
 
         if (a_environmentMapFilepath.empty())
             rc = setDefaultLightEnvironment();
@@ -217,6 +204,231 @@ namespace hoops_luminate_bridge {
 
     FrameStatistics HoopsLuminateBridge::getFrameStatistics() { return m_lastFrameStatistics; }
 
+    bool HoopsLuminateBridge::isDrawRequired() const
+    {
+        return m_bSyncCamera || m_newFrameIsRequired || !m_frameIsComplete || (m_isInteractive && isCameraIdle());
+    }
+
+    void HoopsLuminateBridge::setSyncCamera(const bool a_sync, CameraInfo a_cameraInfo)
+    {
+        // The frame kept around the region of interest no longer matches the view.
+        if (a_sync)
+            RC_CHECK(clearRegionOfInterest());
+
+        if (a_sync) {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+            // A camera update following closely the previous one: the camera is moving.
+            if (!m_isInteractive && 1 < m_interactiveScale &&
+                now - m_lastCameraSync < std::chrono::milliseconds(m_interactiveDelayMilliseconds))
+                RC_CHECK(setInteractiveQuality(true));
+
+            m_lastCameraSync = now;
+        }
+
+        m_bSyncCamera = a_sync;
+        m_cameraInfo = a_cameraInfo;
+        m_lastFrameStatistics = FrameStatistics();
+    }
+
+    RED_RC HoopsLuminateBridge::setRenderQuality(RenderQuality const& a_quality)
+    {
+        RED::Object* resourceManager = RED::Factory::CreateInstance(CID_REDResourceManager);
+        RED::IResourceManager* iresourceManager = resourceManager->As<RED::IResourceManager>();
+
+        // Stop the current frame before changing its settings.
+        resetFrame();
+
+        // Window options override the global ones for this window only.
+        RED::IOptions* iwindowOptions = m_window->As<RED::IOptions>();
+        RC_TEST(iwindowOptions->SetOptionValue(RED::OPTIONS_RAY_GI, a_quality.rayGI, iresourceManager->GetState()));
+        RC_TEST(iwindowOptions->SetOptionValue(RED::OPTIONS_RAY_GI_CACHE_PASSES_COUNT, a_quality.giCachePassesCount, iresourceManager->GetState()));
+        RC_TEST(iwindowOptions->SetOptionValue(RED::OPTIONS_RAY_SHADOWS, a_quality.shadowsDepth, iresourceManager->GetState()));
+        RC_TEST(iwindowOptions->SetOptionValue(RED::OPTIONS_RAY_REFLECTIONS, a_quality.reflectionsDepth, iresourceManager->GetState()));
+        RC_TEST(iwindowOptions->SetOptionValue(RED::OPTIONS_RAY_REFRACTIONS, a_quality.refractionsDepth, iresourceManager->GetState()));
+        RC_TEST(iwindowOptions->SetOptionValue(RED::OPTIONS_RAY_TRANSPARENCY, a_quality.transparencyDepth, iresourceManager->GetState()));
+        RC_TEST(iwindowOptions->SetOptionValue(RED::OPTIONS_PATH_GI, a_quality.pathGI, iresourceManager->GetState()));
+
+        // The interactive mode keeps its low anti aliasing until the camera is idle.
+        m_softAntiAlias = std::max(1, a_quality.softAntiAlias);
+        if (!m_isInteractive) {
+            RED::IWindow* iwindow = m_window->As<RED::IWindow>();
+            RED::Object* auxvrl = NULL;
+            RC_TEST(iwindow->GetVRL(auxvrl, 1));
+
+            RED::IViewpointRenderList* iauxvrl = auxvrl->As<RED::IViewpointRenderList>();
+            RC_TEST(iauxvrl->SetSoftAntiAlias(m_softAntiAlias, iresourceManager->GetState()));
+        }
+
+        return RED_OK;
+    }
+
+    void HoopsLuminateBridge::setFrameBudget(int a_timeMilliseconds, int a_passCount)
+    {
+        m_frameBudgetMilliseconds = std::max(0, a_timeMilliseconds);
+        m_frameBudgetPasses = std::max(0, a_passCount);
+
+        // A frame stopped by the previous budget goes on with the passes traced so far.
+        if (m_frameIsComplete && m_lastFrameStatistics.budgetIsReached) {
+            m_frameIsComplete = false;
+            m_lastFrameStatistics.budgetIsReached = false;
+            m_lastFrameStatistics.renderingIsDone = false;
+        }
+    }
+
+    void HoopsLuminateBridge::setConvergenceThreshold(float a_threshold, int a_minPasses)
+    {
+        m_convergenceThreshold = std::max(0.f, a_threshold);
+        m_convergenceMinPasses = std::max(1, a_minPasses);
+    }
+
+    float HoopsLuminateBridge::measurePassNoise()
+    {
+        const int tileSize = s_noiseTileSize;
+
+        std::vector<unsigned char> pixels;
+        int width = 0, height = 0;
+        if (RED_OK != getRenderImagePixels(pixels, width, height))
+            return -1.f;
+
+        // Only the RGB of the sampled tiles is kept, packed in scan order.
+        std::vector<unsigned char> samples;
+        samples.reserve(((size_t)width * height * 3) / 4 + (size_t)tileSize * width * 3);
+        for (int ty = 0; ty < height; ty += 2 * tileSize) {
+            for (int tx = 0; tx < width; tx += 2 * tileSize) {
+                int tileWidth = std::min(tileSize, width - tx);
+                int tileHeight = std::min(tileSize, height - ty);
+                for (int y = ty; y < ty + tileHeight; ++y) {
+                    const unsigned char* src = &pixels[((size_t)y * width + tx) * 4];
+                    for (int x = 0; x < tileWidth; ++x, src += 4)
+                        samples.insert(samples.end(), src, src + 3);
+                }
+            }
+        }
+
+        float noise = -1.f;
+        if (samples.size() == m_previousPassPixels.size()) {
+            noise = 0.f;
+            size_t offset = 0;
+            for (int ty = 0; ty < height; ty += 2 * tileSize) {
+                for (int tx = 0; tx < width; tx += 2 * tileSize) {
+                    size_t tileBytes = (size_t)std::min(tileSize, width - tx) * std::min(tileSize, height - ty) * 3;
+
+                    long long sum = 0;
+                    for (size_t i = offset; i < offset + tileBytes; ++i) {
+                        int d = (int)samples[i] - (int)m_previousPassPixels[i];
+                        sum += d * d;
+                    }
+                    offset += tileBytes;
+
+                    // The change spans several passes, report it per pass.
+                    float rms = std::sqrt((float)sum / tileBytes) / 255.f / s_noisePassInterval;
+                    noise = std::max(noise, rms);
+                }
+            }
+        }
+
+        m_previousPassPixels.swap(samples);
+
+        return noise;
+    }
+
+    RED_RC HoopsLuminateBridge::setRegionOfInterest(ScreenRegion const& a_region, int a_density)
+    {
+        if (m_windowWidth <= 0 || m_windowHeight <= 0 || m_isInteractive)
+            return RED_FAIL;
+
+        // Snap the region to window pixels so that the crop lands exactly on them.
+        int left = std::max(0, std::min(m_windowWidth - 1, (int)std::floor(a_region.left * m_windowWidth)));
+        int top = std::max(0, std::min(m_windowHeight - 1, (int)std::floor(a_region.top * m_windowHeight)));
+        int right = std::max(left + 1, std::min(m_windowWidth, (int)std::ceil(a_region.right * m_windowWidth)));
+        int bottom = std::max(top + 1, std::min(m_windowHeight, (int)std::ceil(a_region.bottom * m_windowHeight)));
+
+        // Keep the frame traced so far, previous region included, around the new region.
+        std::vector<unsigned char> background;
+        int width = 0, height = 0;
+        RC_TEST(getRenderImagePixels(background, width, height));
+        if (width != m_windowWidth || height != m_windowHeight)
+            return RED_FAIL;
+        m_regionBackground.swap(background);
+
+        resetFrame();
+
+        m_hasRegionOfInterest = true;
+        m_regionOfInterest.left = (float)left / m_windowWidth;
+        m_regionOfInterest.top = (float)top / m_windowHeight;
+        m_regionOfInterest.right = (float)right / m_windowWidth;
+        m_regionOfInterest.bottom = (float)bottom / m_windowHeight;
+        m_regionDensity = std::max(1, std::min(4, a_density));
+
+        RC_TEST(resizeWindow(m_window, (right - left) * m_regionDensity, (bottom - top) * m_regionDensity, 1));
+
+        return syncLuminateCamera(m_cameraInfo);
+    }
+
+    RED_RC HoopsLuminateBridge::clearRegionOfInterest()
+    {
+        if (!m_hasRegionOfInterest)
+            return RED_OK;
+
+        resetFrame();
+
+        m_hasRegionOfInterest = false;
+        std::vector<unsigned char>().swap(m_regionBackground);
+
+        int scale = m_isInteractive ? m_interactiveScale : 1;
+        RC_TEST(resizeWindow(m_window, std::max(1, m_windowWidth / scale), std::max(1, m_windowHeight / scale), 1));
+
+        return syncLuminateCamera(m_cameraInfo);
+    }
+
+    void HoopsLuminateBridge::getRegionRect(int& a_x, int& a_y, int& a_width, int& a_height) const
+    {
+        a_x = (int)std::lround(m_regionOfInterest.left * m_windowWidth);
+        a_y = (int)std::lround(m_regionOfInterest.top * m_windowHeight);
+        a_width = (int)std::lround(m_regionOfInterest.right * m_windowWidth) - a_x;
+        a_height = (int)std::lround(m_regionOfInterest.bottom * m_windowHeight) - a_y;
+    }
+
+    void HoopsLuminateBridge::setInteractiveMode(int a_scale, int a_delayMilliseconds)
+    {
+        m_interactiveScale = std::max(1, a_scale);
+        m_interactiveDelayMilliseconds = std::max(0, a_delayMilliseconds);
+
+        if (m_isInteractive && 1 == m_interactiveScale)
+            RC_CHECK(setInteractiveQuality(false));
+    }
+
+    bool HoopsLuminateBridge::isInteractive() const { return m_isInteractive; }
+
+    bool HoopsLuminateBridge::isCameraIdle() const
+    {
+        return std::chrono::steady_clock::now() - m_lastCameraSync >= std::chrono::milliseconds(m_interactiveDelayMilliseconds);
+    }
+
+    RED_RC HoopsLuminateBridge::setInteractiveQuality(bool a_interactive)
+    {
+        RED::Object* resourceManager = RED::Factory::CreateInstance(CID_REDResourceManager);
+        RED::IResourceManager* iresourceManager = resourceManager->As<RED::IResourceManager>();
+
+        // Stop the current frame before touching the render image.
+        resetFrame();
+
+        m_isInteractive = a_interactive;
+
+        int scale = m_isInteractive ? m_interactiveScale : 1;
+        RC_TEST(resizeWindow(m_window, std::max(1, m_windowWidth / scale), std::max(1, m_windowHeight / scale), 1));
+
+        RED::IWindow* iwindow = m_window->As<RED::IWindow>();
+        RED::Object* auxvrl = NULL;
+        RC_TEST(iwindow->GetVRL(auxvrl, 1));
+
+        RED::IViewpointRenderList* iauxvrl = auxvrl->As<RED::IViewpointRenderList>();
+        RC_TEST(iauxvrl->SetSoftAntiAlias(m_isInteractive ? 1 : m_softAntiAlias, iresourceManager->GetState()));
+
+        return RED_OK;
+    }
+
     std::shared_ptr<LuminateSceneInfo> HoopsLuminateBridge::getConversionData() const { return m_conversionDataPtr; }
 
     SelectedSegmentInfoPtr HoopsLuminateBridge::getSelectedSegmentInfo() const { return m_selectedSegment; }
@@ -249,39 +461,48 @@ namespace hoops_luminate_bridge {
     bool HoopsLuminateBridge::shutdown()
     {
         //////////////////////////////////////////
-        // Shutdown completely Luminate.
-        // This will destroy absolutely all, including
-        // shared resources.
+        // Shutdown this window only.
+        // The resource manager and the shared
+        // lighting models stay alive for the other
+        // windows of the process.
         //////////////////////////////////////////
 
         RED::Object* resourceManager = RED::Factory::CreateInstance(CID_REDResourceManager);
         RED::IResourceManager* iresourceManager = resourceManager->As<RED::IResourceManager>();
 
-        // clean default model
-        iresourceManager->DeleteImage(m_defaultLightingModel.backgroundCubeImage, iresourceManager->GetState());
-        RED::Factory::DeleteInstance(m_defaultLightingModel.skyLight, iresourceManager->GetState());
+        RED::IWindow* iwindow = m_window->As<RED::IWindow>();
+        iwindow->FrameTracingStop();
 
-        // clean sun sky model
-        iresourceManager->DeleteImage(m_sunSkyLightingModel.backgroundCubeImage, iresourceManager->GetState());
-        RED::Factory::DeleteInstance(m_sunSkyLightingModel.skyLight, iresourceManager->GetState());
-        RED::Factory::DeleteInstance(m_sunSkyLightingModel.sunLight, iresourceManager->GetState());
+        // detach the lights before the scene goes away,
+        // env maps are owned by the caller which created them
+        removeCurrentLightingEnvironment();
 
-        // clean env map
-        if (m_environmentMapLightingModel.imagePath != "") {
-            iresourceManager->DeleteImage(m_environmentMapLightingModel.backgroundCubeImage, iresourceManager->GetState());
-            RED::Factory::DeleteInstance(m_environmentMapLightingModel.skyLight, iresourceManager->GetState());
+        if (m_conversionDataPtr != nullptr) {
+            destroyScene(*m_conversionDataPtr);
+            m_conversionDataPtr.reset();
         }
 
-        return shutdownLuminate(m_window) == RED_OK;
+        RED::Factory::DeleteInstance(m_camera, iresourceManager->GetState());
+        m_camera = nullptr;
+
+        RED_RC rc = destroyRedWindow(m_window);
+        m_window = nullptr;
+
+        return rc == RED_OK;
     }
 
     bool HoopsLuminateBridge::resize(int a_windowWidth, int a_windowHeight, CameraInfo a_cameraInfo)
     {
+        // The frame kept around the region of interest no longer matches the window.
+        m_hasRegionOfInterest = false;
+        std::vector<unsigned char>().swap(m_regionBackground);
+
         //////////////////////////////////////////
         // Resize Luminate window.
         //////////////////////////////////////////
 
-        RED_RC rc = resizeWindow(m_window, a_windowWidth, a_windowHeight, 1);
+        int scale = m_isInteractive ? m_interactiveScale : 1;
+        RED_RC rc = resizeWindow(m_window, std::max(1, a_windowWidth / scale), std::max(1, a_windowHeight / scale), 1);
         if (rc != RED_OK)
             return false;
 
@@ -300,10 +521,8 @@ namespace hoops_luminate_bridge {
         return syncLuminateCamera(a_cameraInfo) == RED_OK;
     }
 
-    bool HoopsLuminateBridge::draw()
+    bool HoopsLuminateBridge::prepareFrame()
     {
-        RED_RC rc;
-        
         // update segments if necessary
         //if (m_selectedSegmentTransformIsDirty) {
         //    updateSelectedSegmentTransform();
@@ -314,34 +533,125 @@ namespace hoops_luminate_bridge {
         //    syncRootTransform();
         //}
 
+        // Back to full quality once the camera stopped moving.
+        if (m_isInteractive && !m_bSyncCamera && isCameraIdle())
+            RC_CHECK(setInteractiveQuality(false));
+
         //checkCameraSync();
         if (m_bSyncCamera)
         {
-            rc = syncLuminateCamera(m_cameraInfo);
+            RC_CHECK(syncLuminateCamera(m_cameraInfo));
             m_bSyncCamera = false;
         }
 
-        rc = checkDrawTracing(m_window, m_frameTracingMode, m_frameIsComplete, m_newFrameIsRequired);
+        return m_newFrameIsRequired;
+    }
+
+    bool HoopsLuminateBridge::interruptFrame()
+    {
+        if (m_newFrameIsRequired || m_frameIsComplete)
+            return false;
+
+        RED::IWindow* iwindow = m_window->As<RED::IWindow>();
+        iwindow->FrameTracingStop();
+
+        m_newFrameIsRequired = true;
+        return true;
+    }
+
+    void HoopsLuminateBridge::beginFrame()
+    {
+        if (!m_newFrameIsRequired)
+            return;
+
+        m_newFrameIsRequired = false;
+        m_frameIsComplete = false;
+
+        m_frameStart = std::chrono::steady_clock::now();
+        m_lastTracedPass = -1;
+        m_lastFrameStatistics = FrameStatistics();
+        m_quietPassCount = 0;
+        m_previousPassPixels.clear();
+    }
+
+    bool HoopsLuminateBridge::draw()
+    {
+        // The changes of the new frame are not committed yet: the owner of the
+        // RED transaction, shared by every window, calls beginFrame() once it is.
+        if (prepareFrame())
+            return true;
+
+        bool isTracing = !m_frameIsComplete;
+
+        RED_RC rc = checkDrawTracing(m_window, m_frameTracingMode, m_frameIsComplete, m_newFrameIsRequired);
         // RED_RC rc = checkDrawHardware(m_window);
 
         checkFrameStatistics(m_window, &m_lastFrameStatistics, m_frameIsComplete);
 
+        if (isTracing) {
+            m_lastFrameStatistics.elapsedMilliseconds = std::chrono::duration<float, std::milli>(
+                std::chrono::steady_clock::now() - m_frameStart).count();
+
+            // Passes are counted as they follow each other, the last one when the frame completes.
+            int tracedPasses = m_lastFrameStatistics.tracedPasses;
+            if (m_frameIsComplete)
+                m_lastFrameStatistics.tracedPasses++;
+            else if (m_lastFrameStatistics.currentPass != m_lastTracedPass) {
+                if (0 <= m_lastTracedPass)
+                    m_lastFrameStatistics.tracedPasses++;
+                m_lastTracedPass = m_lastFrameStatistics.currentPass;
+            }
+
+            // Passes have been added to the image: measure how much it still changes.
+            if (!m_frameIsComplete && !m_isInteractive && 0.f < m_convergenceThreshold &&
+                tracedPasses != m_lastFrameStatistics.tracedPasses &&
+                0 == m_lastFrameStatistics.tracedPasses % s_noisePassInterval) {
+                float noise = measurePassNoise();
+                if (0.f <= noise) {
+                    m_lastFrameStatistics.noiseLevel = noise;
+                    m_quietPassCount = noise < m_convergenceThreshold ? m_quietPassCount + 1 : 0;
+                }
+
+                // Visually converged: the remaining passes would not change the image.
+                if (2 <= m_quietPassCount && m_convergenceMinPasses <= m_lastFrameStatistics.tracedPasses) {
+                    m_frameIsComplete = true;
+                    m_lastFrameStatistics.convergedEarly = true;
+                    checkFrameStatistics(m_window, &m_lastFrameStatistics, m_frameIsComplete);
+                }
+            }
+
+            // Out of budget: keep the image refined so far as the final one.
+            if (!m_frameIsComplete && !m_isInteractive &&
+                ((0 < m_frameBudgetMilliseconds && m_frameBudgetMilliseconds <= m_lastFrameStatistics.elapsedMilliseconds) ||
+                 (0 < m_frameBudgetPasses && m_frameBudgetPasses <= m_lastFrameStatistics.tracedPasses))) {
+                m_frameIsComplete = true;
+                m_lastFrameStatistics.budgetIsReached = true;
+                checkFrameStatistics(m_window, &m_lastFrameStatistics, m_frameIsComplete);
+            }
+
+            if (m_frameIsComplete)
+                std::vector<unsigned char>().swap(m_previousPassPixels);
+        }
+
+        // An interactive frame is a preview, the full quality frame is still to come.
+        if (m_isInteractive) {
+            m_lastFrameStatistics.renderingIsDone = false;
+            m_lastFrameStatistics.renderingProgress = std::min(m_lastFrameStatistics.renderingProgress, 0.99f);
+        }
+
         return rc == RED_OK;
     }
 
     void HoopsLuminateBridge::resetFrame()
     {
-        RED::Object* resourceManager = RED::Factory::CreateInstance(CID_REDResourceManager);
-        RED::IResourceManager* iresourceManager = resourceManager->As<RED::IResourceManager>();
-
-        if (iresourceManager->GetState().GetNumber() > 1) {
-            RED::IWindow* iwin = m_window->As<RED::IWindow>();
-            iwin->FrameTracingStop();
-
-            iresourceManager->BeginState();
-        }
+        // Only this window is stopped. The other ones are stopped by the owner of the
+        // shared RED transaction before it is committed, or before an image operation.
+        interruptFrame();
 
         m_newFrameIsRequired = true;
+
+        // Statistics of the previous frame no longer apply
+        m_lastFrameStatistics = FrameStatistics();
     }
 
     bool HoopsLuminateBridge::syncScene(const int a_windowWidth, const int a_windowHeight, CameraInfo a_cameraInfo)
@@ -361,6 +671,22 @@ namespace hoops_luminate_bridge {
         RED::IWindow* window = m_window->As<RED::IWindow>();
         window->FrameTracingStop();
 
+        //////////////////////////////////////////
+        // Same model and conversion options: keep
+        // the scene and its acceleration structure,
+        // the lighting is already attached to it.
+        // Only the view is updated.
+        //////////////////////////////////////////
+
+        if (m_conversionDataPtr != nullptr && isConvertedSceneCurrent()) {
+            resetFrame();
+
+            if (clearRegionOfInterest() != RED_OK)
+                return false;
+
+            return syncLuminateCamera(a_cameraInfo) == RED_OK;
+        }
+
         //////////////////////////////////////////
         // Convert 3DF current scene to Luminate scene
         // and add it to a new camera.
@@ -454,13 +780,15 @@ namespace hoops_luminate_bridge {
         RED::Object* viewpoint;
         RC_TEST(iauxvrl->GetViewpoint(viewpoint, 0));
 
-        RED_RC rc = syncCameras(m_camera, viewHandedness, m_windowWidth, m_windowHeight, a_cameraInfo);
+        RED_RC rc = syncCameras(m_camera, viewHandedness, m_windowWidth, m_windowHeight, a_cameraInfo,
+                                m_hasRegionOfInterest ? &m_regionOfInterest : nullptr);
 
         if (rc != RED_OK)
             return rc;
 
         //rc = synchronizeAxisTriadWithCamera(m_axisTriad, m_camera);
         m_newFrameIsRequired = true;
+        m_lastFrameStatistics = FrameStatistics();
 
         return rc;
     }
@@ -704,7 +1032,11 @@ namespace hoops_luminate_bridge {
         // Apply emvironment map into the auxiliary VRL
         addEnvironmentMapModel(m_window, 2, m_conversionDataPtr->rootTransformShape, envMap);
 
-        // Draw
+        // Every window was stopped by the caller: commit the thumbnail scene, then draw
+        RC_TEST(iresourceManager->EndState());
+        iresourceManager->BeginState();
+        beginFrame();
+
         for (int i = 0; i < 10; i++)
             draw();
 
@@ -783,6 +1115,88 @@ namespace hoops_luminate_bridge {
         return true;
     }
 
+    RED_RC HoopsLuminateBridge::getRenderImagePixels(std::vector<unsigned char>& a_rgba, int& a_width, int& a_height)
+    {
+        if (!m_hasRegionOfInterest)
+            return readRenderImage(a_rgba, a_width, a_height);
+
+        std::vector<unsigned char> crop;
+        int cropWidth = 0, cropHeight = 0;
+        RC_TEST(readRenderImage(crop, cropWidth, cropHeight));
+
+        int x0, y0, width, height;
+        getRegionRect(x0, y0, width, height);
+        if (cropWidth != width * m_regionDensity || cropHeight != height * m_regionDensity)
+            return RED_FAIL;
+
+        // Average the samples of each window pixel into the frame kept around the region.
+        a_rgba = m_regionBackground;
+        a_width = m_windowWidth;
+        a_height = m_windowHeight;
+
+        const int density = m_regionDensity;
+        const int sampleCount = density * density;
+        for (int y = 0; y < height; ++y) {
+            unsigned char* dst = &a_rgba[((size_t)(y0 + y) * a_width + x0) * 4];
+            for (int x = 0; x < width; ++x) {
+                for (int c = 0; c < 4; ++c) {
+                    int sum = 0;
+                    for (int sy = 0; sy < density; ++sy) {
+                        const unsigned char* src = &crop[((size_t)(y * density + sy) * cropWidth + x * density) * 4 + c];
+                        for (int sx = 0; sx < density; ++sx)
+                            sum += src[sx * 4];
+                    }
+                    dst[x * 4 + c] = (unsigned char)((sum + sampleCount / 2) / sampleCount);
+                }
+            }
+        }
+
+        return RED_OK;
+    }
+
+    RED_RC HoopsLuminateBridge::readRenderImage(std::vector<unsigned char>& a_rgba, int& a_width, int& a_height)
+    {
+        RED::IWindow* iwindow = m_window->As<RED::IWindow>();
+
+        RED::Object* auxvrl = NULL;
+        RC_TEST(iwindow->GetVRL(auxvrl, 1));
+
+        RED::IViewpointRenderList* iauxvrl = auxvrl->As<RED::IViewpointRenderList>();
+        RED::Object* renderimg = iauxvrl->GetRenderImage();
+        RED::IImage2D* iimage = renderimg->As<RED::IImage2D>();
+
+        // Copy the render image into its local storage.
+        RC_TEST(iimage->GetPixels());
+
+        const unsigned char* pixels = iimage->GetLocalPixels();
+        a_width = iimage->GetLocalWidth();
+        a_height = iimage->GetLocalHeight();
+        if (pixels == nullptr || a_width <= 0 || a_height <= 0)
+            return RED_FAIL;
+
+        RED::FORMAT format = iimage->GetLocalFormat();
+        if (format != RED::FMT_RGBA && format != RED::FMT_FLOAT_RGBA)
+            return RED_FAIL;
+
+        // Luminate rows are stored bottom-up.
+        a_rgba.resize((size_t)a_width * a_height * 4);
+        for (int y = 0; y < a_height; ++y) {
+            unsigned char* dst = &a_rgba[(size_t)y * a_width * 4];
+
+            if (format == RED::FMT_RGBA) {
+                const unsigned char* src = pixels + (size_t)(a_height - 1 - y) * a_width * 4;
+                memcpy(dst, src, (size_t)a_width * 4);
+            }
+            else {
+                const float* src = (const float*)pixels + (size_t)(a_height - 1 - y) * a_width * 4;
+                for (int i = 0; i < a_width * 4; ++i)
+                    dst[i] = (unsigned char)(std::min(std::max(src[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+            }
+        }
+
+        return RED_OK;
+    }
+
     RED_RC HoopsLuminateBridge::syncModelTransform(double* matrix)
     {
         RED::Object* resourceManager = RED::Factory::CreateInstance(CID_REDResourceManager);
@@ -845,6 +1259,131 @@ namespace hoops_luminate_bridge {
         return RED_OK;
     }
 
+    RenderQuality getRenderProfileQuality(RenderProfile a_profile)
+    {
+        RenderQuality quality;
+
+        switch (a_profile) {
+            case RenderProfile::Draft:
+                // Direct lighting only, for quick look-dev.
+                quality.rayGI = false;
+                quality.giCachePassesCount = 1;
+                quality.shadowsDepth = 1;
+                quality.reflectionsDepth = 1;
+                quality.refractionsDepth = 1;
+                quality.transparencyDepth = 1;
+                quality.pathGI = 1;
+                quality.softAntiAlias = 4;
+                break;
+            case RenderProfile::Final:
+                quality.rayGI = true;
+                quality.giCachePassesCount = 6;
+                quality.shadowsDepth = 6;
+                quality.reflectionsDepth = 6;
+                quality.refractionsDepth = 6;
+                quality.transparencyDepth = 6;
+                quality.pathGI = 6;
+                quality.softAntiAlias = 64;
+                break;
+            default:
+                // Interactive, also the global settings of initializeLuminate.
+                quality.rayGI = true;
+                quality.giCachePassesCount = 3;
+                quality.shadowsDepth = 3;
+                quality.reflectionsDepth = 3;
+                quality.refractionsDepth = 3;
+                quality.transparencyDepth = 3;
+                quality.pathGI = 3;
+                quality.softAntiAlias = 20;
+                break;
+        };
+
+        return quality;
+    }
+
+    RED_RC initializeLuminate(std::string const& a_license)
+    {
+        if (s_luminateIsInitialized)
+            return RED_OK;
+
+        //////////////////////////////////////////
+        // Assign Luminate license.
+        //////////////////////////////////////////
+
+        bool licenseIsActive;
+        RED_RC rc = setLicense(a_license.c_str(), licenseIsActive);
+        if (rc != RED_OK)
+            return rc;
+        if (!licenseIsActive)
+            return RED_FAIL;
+
+        //////////////////////////////////////////
+        // Select Luminate rendering mode.
+        //////////////////////////////////////////
+
+        RC_TEST(setSoftTracerMode(1));
+
+        //////////////////////////////////////////
+        // Retrieve the resource manager from singleton
+        //////////////////////////////////////////
+
+        RED::Object* resourceManager = RED::Factory::CreateInstance(CID_REDResourceManager);
+        RED::IResourceManager* iresourceManager = resourceManager->As<RED::IResourceManager>();
+
+        //////////////////////////////////////////
+        // Set global rendering options.
+        //////////////////////////////////////////
+
+        RED::IOptions* ioptions = resourceManager->As<RED::IOptions>();
+        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_USE_EMBREE, true, iresourceManager->GetState()));
+
+        // Enable raytracer.
+        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_PRIMARY, true, iresourceManager->GetState()));
+
+        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_TONE_MAPPING_IGNORE_BACKGROUND, false, iresourceManager->GetState()));
+
+        // Set raytracing only options
+        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_GI, true, iresourceManager->GetState()));
+        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_GI_CACHE_PASSES_COUNT, 3, iresourceManager->GetState()));
+        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_SHADOWS, 3, iresourceManager->GetState()));
+        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_REFLECTIONS, 3, iresourceManager->GetState()));
+        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_REFRACTIONS, 3, iresourceManager->GetState()));
+        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_TRANSPARENCY, 3, iresourceManager->GetState()));
+
+        // Set pathtracing only options
+        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_PATH_GI, 3, iresourceManager->GetState()));
+
+        // We have the main thread and Vis uses some threads too.
+        // The main thread is preserved by Luminate itself.
+        // Limit the number of threads used by the soft tracer to preserve some interactivity.
+        // A thread budget given by the host replaces this default.
+        int coreCount = iresourceManager->GetNumberOfProcessors();
+        int rayMaxThreadCount = 0 < s_rayMaxThreadCount ? s_rayMaxThreadCount : std::max(1, coreCount - 2);
+        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_MAX_THREADS, rayMaxThreadCount, iresourceManager->GetState()));
+
+        s_luminateIsInitialized = true;
+
+        return RED_OK;
+    }
+
+    RED_RC setRayMaxThreadCount(int a_threadCount)
+    {
+        s_rayMaxThreadCount = std::max(0, a_threadCount);
+
+        if (!s_luminateIsInitialized)
+            return RED_OK;
+
+        RED::Object* resourceManager = RED::Factory::CreateInstance(CID_REDResourceManager);
+        RED::IResourceManager* iresourceManager = resourceManager->As<RED::IResourceManager>();
+        RED::IOptions* ioptions = resourceManager->As<RED::IOptions>();
+
+        int coreCount = iresourceManager->GetNumberOfProcessors();
+        int rayMaxThreadCount = 0 < s_rayMaxThreadCount ? s_rayMaxThreadCount : std::max(1, coreCount - 2);
+        RC_TEST(ioptions->SetOptionValue(RED::OPTIONS_RAY_MAX_THREADS, rayMaxThreadCount, iresourceManager->GetState()));
+
+        return RED_OK;
+    }
+
     RED_RC createRedWindow(void* a_osHandler,
                            int a_width,
                            int a_height,
@@ -899,6 +1438,22 @@ namespace hoops_luminate_bridge {
 
         RC_TEST(RED::Factory::DeleteInstance(resourceManager, iresourceManager->GetState()));
 
+        s_luminateIsInitialized = false;
+        s_sharedLightingModelsCreated = false;
+
+        return RED_OK;
+    }
+
+    RED_RC destroyRedWindow(RED::Object* a_window)
+    {
+        RED::Object* resourceManager = RED::Factory::CreateInstance(CID_REDResourceManager);
+        RED::IResourceManager* iresourceManager = resourceManager->As<RED::IResourceManager>();
+
+        RED::IWindow* window = a_window->As<RED::IWindow>();
+        window->FrameTracingStop();
+
+        RC_TEST(RED::Factory::DeleteInstance(a_window, iresourceManager->GetState()));
+
         return RED_OK;
     }
 
@@ -1028,6 +1583,10 @@ namespace hoops_luminate_bridge {
 
         RC_TEST(RED::Factory::DeleteInstance(a_sceneInfo.rootTransformShape, iresourceManager->GetState()));
 
+        for (RED::Object* shape: a_sceneInfo.detachedShapes) {
+            RC_TEST(RED::Factory::DeleteInstance(shape, iresourceManager->GetState()));
+        }
+
         for (auto const& materialEntry: a_sceneInfo.materials) {
             RC_TEST(iresourceManager->DeleteMaterial(materialEntry.second, iresourceManager->GetState()));
         }
@@ -1067,11 +1626,50 @@ namespace hoops_luminate_bridge {
         return RED_OK;
     }
 
+    /**
+     * Set a projection that maps a region of the view to the whole render image.
+     * @param[in] a_projection Projection of the full view, row-major, OpenGL clip space conventions.
+     */
+    static RED_RC setCroppedFrustum(RED::IViewpoint* a_iviewpoint, double const a_projection[4][4], ScreenRegion const& a_region)
+    {
+        RED::Object* resourceManager = RED::Factory::CreateInstance(CID_REDResourceManager);
+        RED::IResourceManager* iresourceManager = resourceManager->As<RED::IResourceManager>();
+
+        // Region bounds in normalized device coordinates, y pointing up.
+        double u0 = 2.0 * a_region.left - 1.0;
+        double u1 = 2.0 * a_region.right - 1.0;
+        double v0 = 1.0 - 2.0 * a_region.bottom;
+        double v1 = 1.0 - 2.0 * a_region.top;
+
+        // Scale and offset the clip space so that the region fills [-1, 1].
+        double crop[4][4] = { { 2.0 / (u1 - u0), 0.0, 0.0, -(u1 + u0) / (u1 - u0) },
+                              { 0.0, 2.0 / (v1 - v0), 0.0, -(v1 + v0) / (v1 - v0) },
+                              { 0.0, 0.0, 1.0, 0.0 },
+                              { 0.0, 0.0, 0.0, 1.0 } };
+
+        double columnMajor[16];
+        for (int row = 0; row < 4; ++row) {
+            for (int column = 0; column < 4; ++column) {
+                double value = 0.0;
+                for (int k = 0; k < 4; ++k)
+                    value += crop[row][k] * a_projection[k][column];
+                columnMajor[column * 4 + row] = value;
+            }
+        }
+
+        RED::Matrix projection;
+        projection.SetColumnMajorMatrix(columnMajor);
+        RC_TEST(a_iviewpoint->SetFrustumCustom(projection, iresourceManager->GetState()));
+
+        return RED_OK;
+    }
+
     RED_RC syncCameras(RED::Object* a_camera,
                        Handedness a_sceneHandedness,
                        int a_windowWidth,
                        int a_windowHeight,
-                       CameraInfo const& a_cameraInfo)
+                       CameraInfo const& a_cameraInfo,
+                       ScreenRegion const* a_region)
     {
         //////////////////////////////////////////
         // Get the resource manager singleton.
@@ -1169,6 +1767,15 @@ namespace hoops_luminate_bridge {
             double halfFOVXAngleInRadians = std::atan2(0.5 * fieldWidth, distanceToTarget);
             RC_CHECK(
                 iviewpoint->SetFrustumPerspective(halfFOVXAngleInRadians, luminateAspectRatio, iresourceManager->GetState()));
+
+            if (a_region != nullptr) {
+                double tanHalfFOVX = std::tan(halfFOVXAngleInRadians);
+                double projection[4][4] = { { 1.0 / tanHalfFOVX, 0.0, 0.0, 0.0 },
+                                            { 0.0, 1.0 / (tanHalfFOVX * luminateAspectRatio), 0.0, 0.0 },
+                                            { 0.0, 0.0, -(zfar + znear) / (zfar - znear), -2.0 * zfar * znear / (zfar - znear) },
+                                            { 0.0, 0.0, -1.0, 0.0 } };
+                RC_CHECK(setCroppedFrustum(iviewpoint, projection, *a_region));
+            }
         }
         else if (a_cameraInfo.projectionMode == ProjectionMode::Orthographic) {
             // Compute the ortho volume size according red window ratio.
@@ -1184,6 +1791,14 @@ namespace hoops_luminate_bridge {
             // Set ortho projection.
             // The first two parameters are the half size of the ortho volume.
             RC_CHECK(iviewpoint->SetFrustumParallel(new_w / 2, new_h / 2, iresourceManager->GetState()));
+
+            if (a_region != nullptr) {
+                double projection[4][4] = { { 2.0 / new_w, 0.0, 0.0, 0.0 },
+                                            { 0.0, 2.0 / new_h, 0.0, 0.0 },
+                                            { 0.0, 0.0, -2.0 / (zfar - znear), -(zfar + znear) / (zfar - znear) },
+                                            { 0.0, 0.0, 0.0, 1.0 } };
+                RC_CHECK(setCroppedFrustum(iviewpoint, projection, *a_region));
+            }
         }
         else if (a_cameraInfo.projectionMode == ProjectionMode::Stretched) {
             // TODO
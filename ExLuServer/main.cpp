@@ -6,8 +6,10 @@
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <netinet/in.h>
 #else
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #include <direct.h>
 //#include <windows.h>
 #endif
@@ -15,10 +17,18 @@
 #include <stdlib.h>
 #include <string>
 #include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
 #include <microhttpd.h>
 #include "utilities.h"
 #include "ExProcess.h"
 #include "HLuminateServer.h"
+#include "NumaPlacement.h"
 #include <fstream>
 #include <ctime>
 
@@ -28,6 +38,9 @@ using namespace hoops_luminate_bridge;
 #ifndef strcasecmp
 #define strcasecmp(a,b) _stricmp ((a),(b))
 #endif /* !strcasecmp */
+#ifndef strncasecmp
+#define strncasecmp(a,b,n) _strnicmp ((a),(b),(n))
+#endif /* !strncasecmp */
 #endif /* _MSC_VER */
 
 #if defined(_MSC_VER) && _MSC_VER + 0 <= 1800
@@ -37,15 +50,27 @@ using namespace hoops_luminate_bridge;
 
 // #define PORT            8888
 #define POSTBUFFERSIZE  512
-#define MAXCLIENTS      1
-
-static char s_pcModelName[256];
-static std::map<std::string, std::string> s_mParams;
-static char s_floorTexturePath[FILENAME_MAX];
-static unsigned int nr_of_uploading_clients = 0;
+#define MAXCLIENTS      64
+#define EVENTKEEPALIVE  15000
+#define MAXRAWBODYSIZE  (256 * 1024 * 1024)
+
+// Sessions currently hosted by this server and their floor texture with its content hash.
+// Connections are served on their own thread, so they are guarded by s_sessionMutex.
+static std::mutex s_sessionMutex;
+static std::set<std::string> s_sessions;
+static std::map<std::string, std::string> s_mFloorTexturePath;
+static std::map<std::string, unsigned long long> s_mFloorTextureHash;
+static std::chrono::steady_clock::time_point s_lastRequestTime = std::chrono::steady_clock::now();
+
+// Set once the last session terminated, or on console input: main stops the daemon and tears down.
+// Guarded by s_sessionMutex so that no session is started once the shutdown is decided.
+static bool s_bShutdown = false;
+static std::condition_variable s_shutdownCondition;
+
+static std::atomic<unsigned int> nr_of_uploading_clients(0);
 static ExProcess* pExProcess;
 static HLuminateServer* m_pHLuminateServer;
-static char s_current_sessionId[256] = { '\0' };
+static const char* s_materialLibraryDir = "../MaterialLibrary/";
 
 enum ConnectionType
 {
@@ -83,6 +108,22 @@ struct connection_info_struct
     const char* filename;
 
     const char* sessionId;
+
+    /**
+     * Uploaded model file name.
+     */
+    std::string modelName;
+
+    /**
+     * POST parameters of this request.
+     */
+    std::map<std::string, std::string> mParams;
+
+    /**
+     * Body of a POST sent as application/octet-stream, kept as is instead of being post processed.
+     */
+    bool bRawBody;
+    std::vector<char> body;
 };
 
 const char* response_busy = "This server is busy, please try again later.";
@@ -93,12 +134,12 @@ const char* const response_postprocerror = "Error processing POST data";
 const char* response_conversionerror = "Conversion error";
 const char* response_success = "success";
 
-void exportLog(char* msgBuffer, bool isNew = false)
+void exportLog(const char* sessionId, char* msgBuffer, bool isNew = false)
 {
     std::ofstream ofs;
     
     char filePath[FILENAME_MAX];
-    sprintf(filePath, "../%s/logfile.log", s_current_sessionId);
+    sprintf(filePath, "../%s/logfile.log", sessionId);
     std::ios_base::openmode mode = std::ios_base::out;
     if (isNew)
         mode = std::ios_base::out;
@@ -171,6 +212,175 @@ sendResponseFloatArr(struct MHD_Connection *connection, std::vector<float> &floa
 	return ret;
 }
 
+static enum MHD_Result
+sendResponseBinary(struct MHD_Connection* connection, std::vector<unsigned char>& data, const char* contentType,
+    const std::map<std::string, std::string>* headers = NULL)
+{
+    struct MHD_Response* response;
+    MHD_Result ret = MHD_NO;
+
+    response = MHD_create_response_from_buffer(data.size(), (void*)&data[0], MHD_RESPMEM_MUST_COPY);
+    std::vector<unsigned char>().swap(data);
+
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, contentType);
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-store");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN, "*");
+
+    // Extra headers must be exposed to be readable by the browser
+    if (NULL != headers && !headers->empty())
+    {
+        std::string exposed;
+        for (auto it = headers->begin(); it != headers->end(); ++it)
+        {
+            MHD_add_response_header(response, it->first.c_str(), it->second.c_str());
+            exposed += (exposed.empty() ? "" : ", ") + it->first;
+        }
+        MHD_add_response_header(response, "Access-Control-Expose-Headers", exposed.c_str());
+    }
+
+    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+
+    return ret;
+}
+
+// The process server runs on the same host, other clients must not reach its endpoints
+static bool
+isLocalConnection(struct MHD_Connection* connection)
+{
+    const union MHD_ConnectionInfo* info = MHD_get_connection_info(connection, MHD_CONNECTION_INFO_CLIENT_ADDRESS);
+    if (NULL == info || NULL == info->client_addr)
+        return false;
+
+    if (AF_INET == info->client_addr->sa_family)
+    {
+        const struct sockaddr_in* addr = (const struct sockaddr_in*)info->client_addr;
+        return 127 == (ntohl(addr->sin_addr.s_addr) >> 24);
+    }
+    if (AF_INET6 == info->client_addr->sa_family)
+    {
+        const struct sockaddr_in6* addr = (const struct sockaddr_in6*)info->client_addr;
+        const unsigned char* bytes = (const unsigned char*)&addr->sin6_addr;
+        static const unsigned char loopback[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+        static const unsigned char v4Mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+        return 0 == memcmp(bytes, loopback, sizeof(loopback)) ||
+            (0 == memcmp(bytes, v4Mapped, sizeof(v4Mapped)) && 127 == bytes[12]);
+    }
+    return false;
+}
+
+// Frame encoding arguments of the image requests
+// format: png, png-fast, jpeg or auto (default), quality: 1 - 100 for jpeg
+static void
+parseFrameFormat(const char* formatArg, const char* qualityArg, FrameFormat& format, int& quality)
+{
+    format = FRAME_FORMAT_AUTO;
+    if (NULL != formatArg)
+    {
+        if (0 == strcmp(formatArg, "png")) format = FRAME_FORMAT_PNG;
+        else if (0 == strcmp(formatArg, "png-fast")) format = FRAME_FORMAT_PNG_FAST;
+        else if (0 == strcmp(formatArg, "jpeg")) format = FRAME_FORMAT_JPEG;
+    }
+
+    quality = 80;
+    if (NULL != qualityArg)
+        quality = std::atoi(qualityArg);
+}
+
+static void
+getFrameFormatArgs(struct MHD_Connection* connection, FrameFormat& format, int& quality)
+{
+    parseFrameFormat(MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "format"),
+        MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "quality"), format, quality);
+}
+
+// Server-Sent Events stream of the frame statistics of a session
+struct event_stream_struct
+{
+    std::string sessionId;
+    unsigned int passId = 0;
+    std::string pending;
+    size_t offset = 0;
+};
+
+static ssize_t
+readEventStream(void* cls, uint64_t pos, char* buf, size_t max)
+{
+    (void)pos;               /* Unused. Silent compiler warning. */
+    struct event_stream_struct* stream = (event_stream_struct*)cls;
+
+    if (stream->offset >= stream->pending.size())
+    {
+        stream->pending.clear();
+        stream->offset = 0;
+
+        // Block this connection thread until the next pass, a comment line keeps proxies from closing it
+        unsigned int passId = stream->passId;
+        FrameStatistics statistics;
+        if (!m_pHLuminateServer->WaitFrameProgress(stream->sessionId, passId, statistics, EVENTKEEPALIVE))
+            return MHD_CONTENT_READER_END_OF_STREAM;
+
+        if (passId == stream->passId)
+        {
+            stream->pending = ": keep-alive\n\n";
+        }
+        else
+        {
+            stream->passId = passId;
+
+            char buffer[512];
+            snprintf(buffer, sizeof(buffer),
+                "event: frame\ndata: {\"passId\":%u,\"renderingIsDone\":%d,\"renderingProgress\":%f,\"remainingTimeMilliseconds\":%f,\"numberOfPasses\":%d,\"currentPass\":%d,"
+                "\"elapsedMilliseconds\":%f,\"tracedPasses\":%d,\"budgetIsReached\":%d,\"noiseLevel\":%f,\"convergedEarly\":%d}\n\n",
+                passId, statistics.renderingIsDone ? 1 : 0, statistics.renderingProgress, statistics.remainingTimeMilliseconds,
+                statistics.numberOfPasses, statistics.currentPass,
+                statistics.elapsedMilliseconds, statistics.tracedPasses, statistics.budgetIsReached ? 1 : 0,
+                statistics.noiseLevel, statistics.convergedEarly ? 1 : 0);
+            stream->pending = buffer;
+        }
+    }
+
+    size_t size = std::min(max, stream->pending.size() - stream->offset);
+    memcpy(buf, stream->pending.data() + stream->offset, size);
+    stream->offset += size;
+
+    return size;
+}
+
+static void
+freeEventStream(void* cls)
+{
+    delete (event_stream_struct*)cls;
+}
+
+static enum MHD_Result
+sendResponseEventStream(struct MHD_Connection* connection, const std::string& sessionId)
+{
+    struct MHD_Response* response;
+    MHD_Result ret = MHD_NO;
+
+    struct event_stream_struct* stream = new event_stream_struct();
+    stream->sessionId = sessionId;
+
+    response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 1024, &readEventStream, stream, &freeEventStream);
+    if (NULL == response)
+    {
+        delete stream;
+        return MHD_NO;
+    }
+
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, "text/event-stream");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CACHE_CONTROL, "no-store");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN, "*");
+
+    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+
+    return ret;
+}
+
+using ParamMap = std::map<std::string, std::string>;
+
 template <typename List>
 void split(const std::string& s, const std::string& delim, List& result)
 {
@@ -196,38 +406,41 @@ void split(const std::string& s, const std::string& delim, List& result)
     }
 }
 
-bool paramStrToStr(const char *key, std::string &sVal)
+bool paramStrToStr(const ParamMap& mParams, const char *key, std::string &sVal)
 {
-	sVal = s_mParams[std::string(key)];
+	ParamMap::const_iterator it = mParams.find(std::string(key));
+	if (it == mParams.end()) return false;
+
+	sVal = it->second;
 	if (sVal.empty()) return false;
 
 	return true;
 }
 
-bool paramStrToInt(const char *key, int &iVal)
+bool paramStrToInt(const ParamMap& mParams, const char *key, int &iVal)
 {
-	std::string sVal = s_mParams[std::string(key)];
-	if (sVal.empty()) return false;
+	std::string sVal;
+	if (!paramStrToStr(mParams, key, sVal)) return false;
 
 	iVal = std::atoi(sVal.c_str());
 
 	return true;
 }
 
-bool paramStrToDbl(const char *key, double &dVal)
+bool paramStrToDbl(const ParamMap& mParams, const char *key, double &dVal)
 {
-	std::string sVal = s_mParams[std::string(key)];
-	if (sVal.empty()) return false;
+	std::string sVal;
+	if (!paramStrToStr(mParams, key, sVal)) return false;
 
 	dVal = std::atof(sVal.c_str());
 
 	return true;
 }
 
-bool paramStrToXYZ(const char* key, double*& dXYZ)
+bool paramStrToXYZ(const ParamMap& mParams, const char* key, double*& dXYZ)
 {
-    std::string sVal = s_mParams[std::string(key)];
-    if (sVal.empty()) return false;
+    std::string sVal;
+    if (!paramStrToStr(mParams, key, sVal)) return false;
 
     std::vector<std::string> strArr;
     split(sVal.c_str(), ",", strArr);
@@ -246,10 +459,10 @@ bool paramStrToXYZ(const char* key, double*& dXYZ)
     return true;
 }
 
-bool paramStrToDblArr(const char* key, double*& dblArr)
+bool paramStrToDblArr(const ParamMap& mParams, const char* key, double*& dblArr)
 {
-    std::string sVal = s_mParams[std::string(key)];
-    if (sVal.empty()) return false;
+    std::string sVal;
+    if (!paramStrToStr(mParams, key, sVal)) return false;
 
     std::vector<std::string> strArr;
     split(sVal.c_str(), ",", strArr);
@@ -264,10 +477,10 @@ bool paramStrToDblArr(const char* key, double*& dblArr)
     return true;
 }
 
-bool paramStrToIntArr(const char* key, int*& intArr)
+bool paramStrToIntArr(const ParamMap& mParams, const char* key, int*& intArr)
 {
-    std::string sVal = s_mParams[std::string(key)];
-    if (sVal.empty()) return false;
+    std::string sVal;
+    if (!paramStrToStr(mParams, key, sVal)) return false;
 
     std::vector<std::string> strArr;
     split(sVal.c_str(), ",", strArr);
@@ -282,16 +495,77 @@ bool paramStrToIntArr(const char* key, int*& intArr)
     return true;
 }
 
-bool paramStrToChr(const char *key, char &cha)
+bool paramStrToStrArr(const ParamMap& mParams, const char* key, std::vector<std::string>& strArr)
 {
-	std::string sVal = s_mParams[std::string(key)];
-	if (sVal.empty()) return false;
+    std::string sVal;
+    if (!paramStrToStr(mParams, key, sVal)) return false;
+
+    split(sVal.c_str(), ",", strArr);
+
+    return true;
+}
+
+bool paramStrToChr(const ParamMap& mParams, const char *key, char &cha)
+{
+	std::string sVal;
+	if (!paramStrToStr(mParams, key, sVal)) return false;
 
 	cha = sVal.c_str()[0];
 
 	return true;
 }
 
+// Mesh sent as a binary body, little-endian:
+// uint32 vertexCount, uint32 triangleCount, uint32 flags (1: has UVs),
+// float32 positions[3 * vertexCount], uint32 indices[3 * triangleCount], float32 uvs[2 * vertexCount]
+struct BinaryMesh
+{
+    int vertexCount = 0;
+    int triangleCount = 0;
+    const float* points = NULL;
+    const int* indices = NULL;
+    const float* uvs = NULL;
+};
+
+bool parseBinaryMesh(const std::vector<char>& body, BinaryMesh& mesh)
+{
+    const size_t headerSize = 3 * sizeof(uint32_t);
+    if (body.size() < headerSize)
+        return false;
+
+    uint32_t header[3];
+    memcpy(header, body.data(), headerSize);
+
+    const uint32_t vertexCount = header[0];
+    const uint32_t triangleCount = header[1];
+    const bool hasUVs = 0 != (header[2] & 1);
+    if (0 == vertexCount || 0 == triangleCount || (1u << 26) < vertexCount || (1u << 26) < triangleCount)
+        return false;
+
+    const size_t pointsSize = 3 * sizeof(float) * vertexCount;
+    const size_t indicesSize = 3 * sizeof(uint32_t) * triangleCount;
+    const size_t uvsSize = hasUVs ? 2 * sizeof(float) * vertexCount : 0;
+    if (body.size() != headerSize + pointsSize + indicesSize + uvsSize)
+        return false;
+
+    // The body buffer is suitably aligned and every section is a multiple of 4 bytes: no copy is needed
+    const char* data = body.data() + headerSize;
+    mesh.vertexCount = (int)vertexCount;
+    mesh.triangleCount = (int)triangleCount;
+    mesh.points = reinterpret_cast<const float*>(data);
+    mesh.indices = reinterpret_cast<const int*>(data + pointsSize);
+    mesh.uvs = hasUVs ? reinterpret_cast<const float*>(data + pointsSize + indicesSize) : NULL;
+
+    // Indices out of range would be read by the mesh
+    for (uint32_t i = 0; i < 3 * triangleCount; i++)
+    {
+        if (vertexCount <= (uint32_t)mesh.indices[i])
+            return false;
+    }
+
+    return true;
+}
+
 static enum MHD_Result
 iterate_post(void* coninfo_cls,
     enum MHD_ValueKind kind,
@@ -328,8 +602,8 @@ iterate_post(void* coninfo_cls,
 
             char lowext[64], extype[64];
             getLowerExtention(filename, lowext, extype);
-            sprintf(s_pcModelName, "model.%s", lowext);
-            sprintf(filePath, "../%s/%s", con_info->sessionId, s_pcModelName);
+            con_info->modelName = std::string("model.") + lowext;
+            sprintf(filePath, "../%s/%s", con_info->sessionId, con_info->modelName.c_str());
 
             /* NOTE: This is technically a race with the 'fopen()' above,
             but there is no easy fix, short of moving to open(O_EXCL)
@@ -356,8 +630,7 @@ iterate_post(void* coninfo_cls,
     }
     else if (size > 0)
     {
-        s_mParams.insert(std::make_pair(std::string(key), std::string(data)));
-        printf("key: %s, data: %s\n", key, data);
+        con_info->mParams.insert(std::make_pair(std::string(key), std::string(data)));
     }
 
     return MHD_YES;
@@ -381,16 +654,15 @@ request_completed(void* cls,
     if (con_info->connectiontype == POST)
     {
         if (NULL != con_info->postprocessor)
-        {
             MHD_destroy_post_processor(con_info->postprocessor);
-            nr_of_uploading_clients--;
-        }
+
+        nr_of_uploading_clients--;
 
         if (con_info->fp)
             fclose(con_info->fp);
     }
 
-    free(con_info);
+    delete con_info;
     *con_cls = NULL;
 }
 
@@ -417,65 +689,117 @@ answer_to_connection(void* cls,
         if (nr_of_uploading_clients >= MAXCLIENTS)
             return sendResponseText(connection, response_busy, MHD_HTTP_OK);
 
-        con_info = (connection_info_struct*)malloc(sizeof(struct connection_info_struct));
-        if (NULL == con_info)
-            return MHD_NO;
-        con_info->answercode = 0;   /* none yet */
-        con_info->fp = NULL;
-        s_mParams.clear();
-
         printf("--- New %s request for %s using version %s\n", method, url, version);
-        con_info->sessionId = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "session_id");
-        printf("Session ID: %s\n", con_info->sessionId);
 
-        if (strlen(s_current_sessionId))
+        // CORS preflight of the binary POST requests, which are not simple requests
+        if (0 == strcasecmp(method, MHD_HTTP_METHOD_OPTIONS))
         {
-            if (0 != strcmp(s_current_sessionId, con_info->sessionId))
-            {
-                printf("Server is busy\n");
+            struct MHD_Response* response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
+            MHD_add_response_header(response, MHD_HTTP_HEADER_ACCESS_CONTROL_ALLOW_ORIGIN, "*");
+            MHD_add_response_header(response, "Access-Control-Allow-Methods", "GET, POST");
+            MHD_add_response_header(response, "Access-Control-Allow-Headers", "Content-Type");
+            MHD_Result ret = MHD_queue_response(connection, MHD_HTTP_NO_CONTENT, response);
+            MHD_destroy_response(response);
+            return ret;
+        }
 
-                con_info->answerstring = response_servererror;
-                con_info->answercode = MHD_HTTP_OK;
-                return sendResponseText(connection, con_info->answerstring, con_info->answercode);
+        // Host scheduler, not tied to a session: hands out the thread budget and reads the render demand
+        // threads: soft tracer threads of this process, 0 pauses the rendering
+        if (0 == strcmp(url, "/Scheduler"))
+        {
+            // The thread budget is process wide, only the process server may change it
+            if (!isLocalConnection(connection))
+                return sendResponseText(connection, response_error, MHD_HTTP_FORBIDDEN);
+
+            const char* threadsArg = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "threads");
+            if (NULL != threadsArg)
+                m_pHLuminateServer->SetThreadBudget(std::atoi(threadsArg));
+
+            // Sessions and their last request let the process server reclaim abandoned instances only
+            size_t sessionCount = 0;
+            long long idleSeconds = 0;
+            {
+                std::lock_guard<std::mutex> lock(s_sessionMutex);
+                sessionCount = s_sessions.size();
+                idleSeconds = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - s_lastRequestTime).count();
             }
+
+            char buffer[128];
+            snprintf(buffer, sizeof(buffer), "{\"demand\":%d,\"sessions\":%d,\"idle\":%lld}",
+                m_pHLuminateServer->GetRenderDemand(), (int)sessionCount, idleSeconds);
+            return sendResponseText(connection, buffer, MHD_HTTP_OK);
         }
-        else
+
+        const char* sessionId = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "session_id");
+        printf("Session ID: %s\n", sessionId);
+
+        if (NULL == sessionId || 0 == strlen(sessionId))
+            return sendResponseText(connection, response_servererror, MHD_HTTP_OK);
+
         {
-            strcpy(s_current_sessionId, con_info->sessionId);
+            std::lock_guard<std::mutex> lock(s_sessionMutex);
 
-            // Create working dir
-            char workingDir[FILENAME_MAX];
-            sprintf(workingDir, "../%s", con_info->sessionId);
+            if (s_bShutdown)
+                return sendResponseText(connection, response_busy, MHD_HTTP_OK);
+
+            s_lastRequestTime = std::chrono::steady_clock::now();
+
+            if (0 == s_sessions.count(sessionId))
+            {
+                // Create working dir
+                char workingDir[FILENAME_MAX];
+                sprintf(workingDir, "../%s", sessionId);
 
 #ifndef _WIN32
-            if (0 != mkdir(workingDir, 0777))
+                if (0 != mkdir(workingDir, 0777))
 #else
-            if (0 != mkdir(workingDir))
+                if (0 != mkdir(workingDir))
 #endif
-            {
-                con_info->answerstring = response_servererror;
-                con_info->answercode = MHD_HTTP_OK;
-                return sendResponseText(connection, con_info->answerstring, con_info->answercode);
-            }
+                {
+                    return sendResponseText(connection, response_servererror, MHD_HTTP_OK);
+                }
 
-            // Log
-            char buffer[256];
-            sprintf(buffer, "New session was started: %s", s_current_sessionId);
-            exportLog(buffer, true);
+                s_sessions.insert(sessionId);
+
+                // Log
+                char buffer[256];
+                sprintf(buffer, "New session was started: %s", sessionId);
+                exportLog(sessionId, buffer, true);
+            }
         }
 
+        con_info = new connection_info_struct();
+        con_info->answercode = 0;   /* none yet */
+        con_info->fp = NULL;
+        con_info->postprocessor = NULL;
+        con_info->sessionId = sessionId;
+        con_info->bRawBody = false;
+
         if (0 == strcasecmp(method, MHD_HTTP_METHOD_POST))
         {
-            con_info->postprocessor =
-                MHD_create_post_processor(connection,
-                    POSTBUFFERSIZE,
-                    &iterate_post,
-                    (void*)con_info);
+            // Binary payloads (e.g. geometry) skip the form parsing
+            const char* contentType = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_CONTENT_TYPE);
+            if (NULL != contentType && 0 == strncasecmp(contentType, "application/octet-stream", 24))
+            {
+                con_info->bRawBody = true;
 
-            if (NULL == con_info->postprocessor)
+                const char* contentLength = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_CONTENT_LENGTH);
+                if (NULL != contentLength)
+                    con_info->body.reserve(std::min(std::strtoul(contentLength, NULL, 10), (unsigned long)MAXRAWBODYSIZE));
+            }
+            else
             {
-                free(con_info);
-                return MHD_NO;
+                con_info->postprocessor =
+                    MHD_create_post_processor(connection,
+                        POSTBUFFERSIZE,
+                        &iterate_post,
+                        (void*)con_info);
+
+                if (NULL == con_info->postprocessor)
+                {
+                    delete con_info;
+                    return MHD_NO;
+                }
             }
 
             nr_of_uploading_clients++;
@@ -494,6 +818,47 @@ answer_to_connection(void* cls,
 
     if (0 == strcasecmp(method, MHD_HTTP_METHOD_GET))
     {
+        struct connection_info_struct* con_info = (connection_info_struct*)*con_cls;
+
+        if (0 == strcmp(url, "/Frame"))
+        {
+            // Current render image, encoded in memory
+            FrameFormat format;
+            int quality;
+            getFrameFormatArgs(connection, format, quality);
+
+            std::vector<unsigned char> image;
+            if (!m_pHLuminateServer->GetFrame(con_info->sessionId, format, quality, image))
+                return sendResponseText(connection, response_servererror, MHD_HTTP_NOT_FOUND);
+
+            return sendResponseBinary(connection, image, getFrameContentType(format));
+        }
+        else if (0 == strcmp(url, "/FrameTiles"))
+        {
+            // Tiles of the render image changed since the frame the client holds
+            // base: frame id of the last payload applied by the client (0 for a full frame), quality: 1 - 100 for jpeg tiles
+            unsigned int baseFrameId = 0;
+            const char* baseArg = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "base");
+            if (NULL != baseArg)
+                baseFrameId = (unsigned int)std::strtoul(baseArg, NULL, 10);
+
+            int quality = 80;
+            const char* qualityArg = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "quality");
+            if (NULL != qualityArg)
+                quality = std::atoi(qualityArg);
+
+            std::vector<unsigned char> payload;
+            if (!m_pHLuminateServer->GetFrameTiles(con_info->sessionId, baseFrameId, quality, payload))
+                return sendResponseText(connection, response_servererror, MHD_HTTP_NOT_FOUND);
+
+            return sendResponseBinary(connection, payload, "application/octet-stream");
+        }
+        else if (0 == strcmp(url, "/Events"))
+        {
+            // Frame statistics pushed after each pass, replaces polling /Draw
+            return sendResponseEventStream(connection, con_info->sessionId);
+        }
+
         return sendResponseSuccess(connection);
     }
 
@@ -510,7 +875,19 @@ answer_to_connection(void* cls,
                 *upload_data_size = 0;
                 return MHD_YES;
             }
-            if (MHD_YES !=
+            if (con_info->bRawBody)
+            {
+                if (MAXRAWBODYSIZE < con_info->body.size() + *upload_data_size)
+                {
+                    con_info->answerstring = response_postprocerror;
+                    con_info->answercode = MHD_HTTP_INTERNAL_SERVER_ERROR;
+                }
+                else
+                {
+                    con_info->body.insert(con_info->body.end(), upload_data, upload_data + *upload_data_size);
+                }
+            }
+            else if (MHD_YES !=
                 MHD_post_process(con_info->postprocessor,
                     upload_data,
                     *upload_data_size))
@@ -527,7 +904,7 @@ answer_to_connection(void* cls,
         // Log
         char buffer[256];
         sprintf(buffer, "Called: %s", url);
-        exportLog(buffer);
+        exportLog(con_info->sessionId, buffer);
 
         if (0 == strcmp(url, "/Clear"))
         {
@@ -545,15 +922,19 @@ answer_to_connection(void* cls,
             delete_dirs(wscDir);
 #endif
 
-            // Delete ModelFile
-            pExProcess->DeleteModelFile(con_info->sessionId);
+            // Delete the extracted scene
+            pExProcess->DeleteSceneData(con_info->sessionId);
 
             // Delete Luminate session
             if (m_pHLuminateServer->ClearSession(con_info->sessionId))
                 printf("HOOPS Luminate is terminated.\n");
 
-            strcpy(s_current_sessionId, "");
-            sprintf(s_floorTexturePath, "");
+            {
+                std::lock_guard<std::mutex> lock(s_sessionMutex);
+                s_sessions.erase(con_info->sessionId);
+                s_mFloorTexturePath.erase(con_info->sessionId);
+                s_mFloorTextureHash.erase(con_info->sessionId);
+            }
 
             con_info->answerstring = response_success;
             con_info->answercode = MHD_HTTP_OK;
@@ -583,14 +964,27 @@ answer_to_connection(void* cls,
             delete_dirs(wscDir);
 #endif
 
-            delete pExProcess;
+            // Release this session, the process is kept alive while other sessions remain
+            pExProcess->DeleteSceneData(con_info->sessionId);
+            m_pHLuminateServer->ClearSession(con_info->sessionId);
 
-            m_pHLuminateServer->Terminate();
-            delete m_pHLuminateServer;
+            {
+                std::lock_guard<std::mutex> lock(s_sessionMutex);
+                s_sessions.erase(con_info->sessionId);
+                s_mFloorTexturePath.erase(con_info->sessionId);
+                s_mFloorTextureHash.erase(con_info->sessionId);
 
-            printf("HOOPS Luminate terminated\n");
+                // Last session: main stops the daemon, waiting for the other connections, then tears down
+                if (s_sessions.empty())
+                {
+                    s_bShutdown = true;
+                    s_shutdownCondition.notify_all();
+                }
+            }
 
-            exit(0);
+            con_info->answerstring = response_success;
+            con_info->answercode = MHD_HTTP_OK;
+            return sendResponseText(connection, con_info->answerstring, con_info->answercode);
         }
         else if (0 == strcmp(url, "/FileUpload"))
         {
@@ -604,14 +998,14 @@ answer_to_connection(void* cls,
                 /* No errors encountered, declare success */
                 // Convert to SC
                 char basename[256], filePath[FILENAME_MAX], scPath[FILENAME_MAX];
-                getBaseName(s_pcModelName, basename);
+                getBaseName(con_info->modelName.c_str(), basename);
 
-                sprintf(filePath, "../%s/%s", con_info->sessionId, s_pcModelName);
+                sprintf(filePath, "../%s/%s", con_info->sessionId, con_info->modelName.c_str());
                 sprintf(scPath, "../%s/model.scs", con_info->sessionId);
                 
                 char lowExt[256];
                 char fileType[256];
-                getLowerExtention(s_pcModelName, lowExt, fileType);
+                getLowerExtention(con_info->modelName.c_str(), lowExt, fileType);
 
                 std::vector<float> floatArr;
                 if (0 == strcmp(lowExt, "hdr"))
@@ -631,7 +1025,15 @@ answer_to_connection(void* cls,
                 }
                 else if (0 == strcmp(lowExt, "jpg") || 0 == strcmp(lowExt, "jpeg") || 0 == strcmp(lowExt, "png"))
                 {
-                    strcpy(s_floorTexturePath, filePath);
+                    // The texture is decoded again only when the uploaded content differs
+                    unsigned long long textureHash = 0;
+                    hash_file(filePath, textureHash);
+
+                    {
+                        std::lock_guard<std::mutex> lock(s_sessionMutex);
+                        s_mFloorTexturePath[con_info->sessionId] = filePath;
+                        s_mFloorTextureHash[con_info->sessionId] = textureHash;
+                    }
 
                     floatArr.push_back(1);
                     con_info->answerstring = response_success;
@@ -642,7 +1044,11 @@ answer_to_connection(void* cls,
                     // Load 3D CAD file
                     printf("converting...\n");
 
-                    if (pExProcess->LoadFile(con_info->sessionId, filePath, scPath))
+                    // The Luminate scene is built on the Luminate thread while the SC model is exported
+                    std::string sessionId = con_info->sessionId;
+                    if (pExProcess->LoadFile(con_info->sessionId, filePath, scPath, [sessionId](ExSceneDataPtr sceneData) {
+                            m_pHLuminateServer->PrebuildScene(sessionId, sceneData);
+                        }))
                         floatArr.push_back(1);
                     else
                         floatArr.push_back(0);
@@ -657,20 +1063,20 @@ answer_to_connection(void* cls,
         else if (0 == strcmp(url, "/PrepareRendering"))
         {
             double width, height;
-            if (!paramStrToDbl("width", width)) return MHD_NO;
-            if (!paramStrToDbl("height", height)) return MHD_NO;
+            if (!paramStrToDbl(con_info->mParams, "width", width)) return MHD_NO;
+            if (!paramStrToDbl(con_info->mParams, "height", height)) return MHD_NO;
 
             double* target, * up, * position;
-            if (!paramStrToXYZ("target", target)) return MHD_NO;
-            if (!paramStrToXYZ("up", up)) return MHD_NO;
-            if (!paramStrToXYZ("position", position)) return MHD_NO;
+            if (!paramStrToXYZ(con_info->mParams, "target", target)) return MHD_NO;
+            if (!paramStrToXYZ(con_info->mParams, "up", up)) return MHD_NO;
+            if (!paramStrToXYZ(con_info->mParams, "position", position)) return MHD_NO;
 
             int projection;
-            if (!paramStrToInt("projection", projection)) return MHD_NO;
+            if (!paramStrToInt(con_info->mParams, "projection", projection)) return MHD_NO;
 
             double cameraW, cameraH;
-            if (!paramStrToDbl("cameraW", cameraW)) return MHD_NO;
-            if (!paramStrToDbl("cameraH", cameraH)) return MHD_NO;
+            if (!paramStrToDbl(con_info->mParams, "cameraW", cameraW)) return MHD_NO;
+            if (!paramStrToDbl(con_info->mParams, "cameraH", cameraH)) return MHD_NO;
 
             if (m_pHLuminateServer->PrepareRendering(con_info->sessionId,
                 target, up, position, projection, cameraW, cameraH, width, height))
@@ -685,30 +1091,62 @@ answer_to_connection(void* cls,
             return sendResponseText(connection, con_info->answerstring, con_info->answercode);
 
         }
+        else if (0 == strcmp(url, "/Render"))
+        {
+            // Restart the frame and answer with the image reached within the budget
+            // timeBudget: milliseconds, passBudget: traced passes, 0 or missing for no limit
+            std::string formatParam, qualityParam;
+            bool bFormat = paramStrToStr(con_info->mParams, "format", formatParam);
+            bool bQuality = paramStrToStr(con_info->mParams, "quality", qualityParam);
+
+            FrameFormat format;
+            int quality;
+            parseFrameFormat(bFormat ? formatParam.c_str() : NULL, bQuality ? qualityParam.c_str() : NULL, format, quality);
+
+            int timeBudget = 0, passBudget = 0;
+            paramStrToInt(con_info->mParams, "timeBudget", timeBudget);
+            paramStrToInt(con_info->mParams, "passBudget", passBudget);
+
+            std::vector<unsigned char> image;
+            FrameStatistics statistics;
+            if (!m_pHLuminateServer->Render(con_info->sessionId, timeBudget, passBudget, format, quality, image, statistics))
+                return sendResponseText(connection, response_servererror, MHD_HTTP_NOT_FOUND);
+
+            // What was reached
+            std::map<std::string, std::string> headers;
+            headers["X-Rendering-Progress"] = std::to_string(statistics.renderingProgress);
+            headers["X-Elapsed-Milliseconds"] = std::to_string(statistics.elapsedMilliseconds);
+            headers["X-Traced-Passes"] = std::to_string(statistics.tracedPasses);
+            headers["X-Budget-Reached"] = statistics.budgetIsReached ? "1" : "0";
+            headers["X-Noise-Level"] = std::to_string(statistics.noiseLevel);
+            headers["X-Converged-Early"] = statistics.convergedEarly ? "1" : "0";
+
+            return sendResponseBinary(connection, image, getFrameContentType(format), &headers);
+        }
         else if (0 == strcmp(url, "/Raytracing"))
         {
             double width, height;
-            if (!paramStrToDbl("width", width)) return MHD_NO;
-            if (!paramStrToDbl("height", height)) return MHD_NO;
+            if (!paramStrToDbl(con_info->mParams, "width", width)) return MHD_NO;
+            if (!paramStrToDbl(con_info->mParams, "height", height)) return MHD_NO;
 
             double *target, *up, *position;
-            if (!paramStrToXYZ("target", target)) return MHD_NO;
-            if (!paramStrToXYZ("up", up)) return MHD_NO;
-            if (!paramStrToXYZ("position", position)) return MHD_NO;
+            if (!paramStrToXYZ(con_info->mParams, "target", target)) return MHD_NO;
+            if (!paramStrToXYZ(con_info->mParams, "up", up)) return MHD_NO;
+            if (!paramStrToXYZ(con_info->mParams, "position", position)) return MHD_NO;
 
             int projection;
-            if (!paramStrToInt("projection", projection)) return MHD_NO;
+            if (!paramStrToInt(con_info->mParams, "projection", projection)) return MHD_NO;
 
             double cameraW, cameraH;
-            if (!paramStrToDbl("cameraW", cameraW)) return MHD_NO;
-            if (!paramStrToDbl("cameraH", cameraH)) return MHD_NO;
+            if (!paramStrToDbl(con_info->mParams, "cameraW", cameraW)) return MHD_NO;
+            if (!paramStrToDbl(con_info->mParams, "cameraH", cameraH)) return MHD_NO;
 
-            A3DEntity* pPrcIdMap;
-            A3DAsmModelFile* pModelFile = pExProcess->GetModelFile(con_info->sessionId, pPrcIdMap);
+            // The scene was extracted from Exchange, or read from the conversion cache, at upload
+            ExSceneDataPtr sceneData = pExProcess->GetSceneData(con_info->sessionId);
 
             m_pHLuminateServer->StartRendering(con_info->sessionId, 
                 target, up, position, projection, cameraW, cameraH, 
-                width, height, pModelFile, pPrcIdMap);
+                width, height, sceneData);
 
             con_info->answerstring = response_success;
             con_info->answercode = MHD_HTTP_OK;
@@ -717,11 +1155,8 @@ answer_to_connection(void* cls,
         }
         else if (0 == strcmp(url, "/Draw"))
         {
-
-            char filePath[FILENAME_MAX];
-            sprintf(filePath, "../%s/image.png", con_info->sessionId);
-
-            std::vector<float> floatArr = m_pHLuminateServer->Draw(con_info->sessionId, filePath);
+            // The image itself is fetched from /Frame
+            std::vector<float> floatArr = m_pHLuminateServer->Draw(con_info->sessionId);
 
             con_info->answerstring = response_success;
             con_info->answercode = MHD_HTTP_OK;
@@ -731,16 +1166,16 @@ answer_to_connection(void* cls,
         else if (0 == strcmp(url, "/SyncCamera"))
         {
             double* target, * up, * position;
-            if (!paramStrToXYZ("target", target)) return MHD_NO;
-            if (!paramStrToXYZ("up", up)) return MHD_NO;
-            if (!paramStrToXYZ("position", position)) return MHD_NO;
+            if (!paramStrToXYZ(con_info->mParams, "target", target)) return MHD_NO;
+            if (!paramStrToXYZ(con_info->mParams, "up", up)) return MHD_NO;
+            if (!paramStrToXYZ(con_info->mParams, "position", position)) return MHD_NO;
 
             int projection;
-            if (!paramStrToInt("projection", projection)) return MHD_NO;
+            if (!paramStrToInt(con_info->mParams, "projection", projection)) return MHD_NO;
 
             double cameraW, cameraH;
-            if (!paramStrToDbl("cameraW", cameraW)) return MHD_NO;
-            if (!paramStrToDbl("cameraH", cameraH)) return MHD_NO;
+            if (!paramStrToDbl(con_info->mParams, "cameraW", cameraW)) return MHD_NO;
+            if (!paramStrToDbl(con_info->mParams, "cameraH", cameraH)) return MHD_NO;
 
             m_pHLuminateServer->SyncCamera(con_info->sessionId, target, up, position, projection, cameraW, cameraH);
 
@@ -752,20 +1187,20 @@ answer_to_connection(void* cls,
         else if (0 == strcmp(url, "/Resize"))
         {
             double width, height;
-            if (!paramStrToDbl("width", width)) return MHD_NO;
-            if (!paramStrToDbl("height", height)) return MHD_NO;
+            if (!paramStrToDbl(con_info->mParams, "width", width)) return MHD_NO;
+            if (!paramStrToDbl(con_info->mParams, "height", height)) return MHD_NO;
 
             double* target, * up, * position;
-            if (!paramStrToXYZ("target", target)) return MHD_NO;
-            if (!paramStrToXYZ("up", up)) return MHD_NO;
-            if (!paramStrToXYZ("position", position)) return MHD_NO;
+            if (!paramStrToXYZ(con_info->mParams, "target", target)) return MHD_NO;
+            if (!paramStrToXYZ(con_info->mParams, "up", up)) return MHD_NO;
+            if (!paramStrToXYZ(con_info->mParams, "position", position)) return MHD_NO;
 
             int projection;
-            if (!paramStrToInt("projection", projection)) return MHD_NO;
+            if (!paramStrToInt(con_info->mParams, "projection", projection)) return MHD_NO;
 
             double cameraW, cameraH;
-            if (!paramStrToDbl("cameraW", cameraW)) return MHD_NO;
-            if (!paramStrToDbl("cameraH", cameraH)) return MHD_NO;
+            if (!paramStrToDbl(con_info->mParams, "cameraW", cameraW)) return MHD_NO;
+            if (!paramStrToDbl(con_info->mParams, "cameraH", cameraH)) return MHD_NO;
 
             m_pHLuminateServer->Resize(con_info->sessionId, target, up, position, projection, cameraW, cameraH, width, height);
 
@@ -777,15 +1212,15 @@ answer_to_connection(void* cls,
         else if (0 == strcmp(url, "/SetMaterial"))
         {
             std::string nodeName, redFile;
-            if (!paramStrToStr("nodeName", nodeName)) return MHD_NO;
-            if (!paramStrToStr("redFile", redFile)) return MHD_NO;
+            if (!paramStrToStr(con_info->mParams, "nodeName", nodeName)) return MHD_NO;
+            if (!paramStrToStr(con_info->mParams, "redFile", redFile)) return MHD_NO;
 
             int preserveColor, overrideMaterial;
-            if (!paramStrToInt("preserveColor", preserveColor)) return MHD_NO;
-            if (!paramStrToInt("overrideMaterial", overrideMaterial)) return MHD_NO;
+            if (!paramStrToInt(con_info->mParams, "preserveColor", preserveColor)) return MHD_NO;
+            if (!paramStrToInt(con_info->mParams, "overrideMaterial", overrideMaterial)) return MHD_NO;
 
             // Get material
-            RED::String redfilename = RED::String("..\\MaterialLibrary\\");
+            RED::String redfilename = RED::String(s_materialLibraryDir);
             redfilename.Add(RED::String(redFile.data()));
 
             m_pHLuminateServer->SetMaterial(con_info->sessionId, nodeName.data(), redfilename, (bool)overrideMaterial, (bool)preserveColor);
@@ -795,10 +1230,74 @@ answer_to_connection(void* cls,
 
             return sendResponseText(connection, con_info->answerstring, con_info->answercode);
         }
+        else if (0 == strcmp(url, "/SetMaterials"))
+        {
+            // Same material on a batch of nodes, the frame is restarted once
+            std::vector<std::string> nodeNames;
+            std::string redFile;
+            if (!paramStrToStrArr(con_info->mParams, "nodeNames", nodeNames)) return MHD_NO;
+            if (!paramStrToStr(con_info->mParams, "redFile", redFile)) return MHD_NO;
+
+            int preserveColor, overrideMaterial;
+            if (!paramStrToInt(con_info->mParams, "preserveColor", preserveColor)) return MHD_NO;
+            if (!paramStrToInt(con_info->mParams, "overrideMaterial", overrideMaterial)) return MHD_NO;
+
+            RED::String redfilename = RED::String(s_materialLibraryDir);
+            redfilename.Add(RED::String(redFile.data()));
+
+            if (m_pHLuminateServer->SetMaterials(con_info->sessionId, nodeNames, redfilename, (bool)overrideMaterial, (bool)preserveColor))
+                con_info->answerstring = response_success;
+            else
+                con_info->answerstring = response_error;
+
+            con_info->answercode = MHD_HTTP_OK;
+            return sendResponseText(connection, con_info->answerstring, con_info->answercode);
+        }
+        else if (0 == strcmp(url, "/EditMaterial"))
+        {
+            // Properties of the materials assigned to the nodes, only the given ones are changed
+            std::vector<std::string> nodeNames;
+            if (!paramStrToStrArr(con_info->mParams, "nodeNames", nodeNames)) return MHD_NO;
+
+            MaterialEdit edit;
+
+            double* rgb;
+            if (paramStrToXYZ(con_info->mParams, "diffuseColor", rgb))
+            {
+                edit.bDiffuseColor = true;
+                edit.diffuseColor = RED::Color(float(rgb[0]), float(rgb[1]), float(rgb[2]), 1.f);
+                delete[] rgb;
+            }
+
+            if (paramStrToXYZ(con_info->mParams, "reflectionColor", rgb))
+            {
+                edit.bReflectionColor = true;
+                edit.reflectionColor = RED::Color(float(rgb[0]), float(rgb[1]), float(rgb[2]), 1.f);
+                delete[] rgb;
+            }
+
+            double value;
+            if (paramStrToDbl(con_info->mParams, "roughness", value))
+                edit.roughness = (float)std::min(std::max(value, 0.0), 1.0);
+
+            if (paramStrToDbl(con_info->mParams, "ior", value))
+                edit.ior = (float)value;
+
+            if (paramStrToDbl(con_info->mParams, "transmission", value))
+                edit.transmission = (float)std::min(std::max(value, 0.0), 1.0);
+
+            if (m_pHLuminateServer->EditMaterial(con_info->sessionId, nodeNames, edit))
+                con_info->answerstring = response_success;
+            else
+                con_info->answerstring = response_error;
+
+            con_info->answercode = MHD_HTTP_OK;
+            return sendResponseText(connection, con_info->answerstring, con_info->answercode);
+        }
         else if (0 == strcmp(url, "/SetLighting"))
         {
             int lightingId;
-            if (!paramStrToInt("lightingId", lightingId)) return MHD_NO;
+            if (!paramStrToInt(con_info->mParams, "lightingId", lightingId)) return MHD_NO;
 
             m_pHLuminateServer->SetLighting(con_info->sessionId, lightingId);
 
@@ -807,10 +1306,107 @@ answer_to_connection(void* cls,
 
             return sendResponseText(connection, con_info->answerstring, con_info->answercode);
         }
+        else if (0 == strcmp(url, "/SetRenderProfile"))
+        {
+            std::string profileName;
+            if (!paramStrToStr(con_info->mParams, "profile", profileName)) return MHD_NO;
+
+            RenderProfile profile;
+            if ("draft" == profileName) profile = RenderProfile::Draft;
+            else if ("interactive" == profileName) profile = RenderProfile::Interactive;
+            else if ("final" == profileName) profile = RenderProfile::Final;
+            else if ("custom" == profileName) profile = RenderProfile::Custom;
+            else return MHD_NO;
+
+            RenderQuality quality = getRenderProfileQuality(profile);
+
+            // A custom profile only overrides the given settings
+            if (RenderProfile::Custom == profile)
+            {
+                int rayGI = quality.rayGI ? 1 : 0;
+                paramStrToInt(con_info->mParams, "rayGI", rayGI);
+                quality.rayGI = 0 != rayGI;
+                paramStrToInt(con_info->mParams, "giCachePasses", quality.giCachePassesCount);
+                paramStrToInt(con_info->mParams, "shadows", quality.shadowsDepth);
+                paramStrToInt(con_info->mParams, "reflections", quality.reflectionsDepth);
+                paramStrToInt(con_info->mParams, "refractions", quality.refractionsDepth);
+                paramStrToInt(con_info->mParams, "transparency", quality.transparencyDepth);
+                paramStrToInt(con_info->mParams, "pathGI", quality.pathGI);
+                paramStrToInt(con_info->mParams, "antiAlias", quality.softAntiAlias);
+            }
+
+            if (m_pHLuminateServer->SetRenderQuality(con_info->sessionId, quality))
+                con_info->answerstring = response_success;
+            else
+                con_info->answerstring = response_error;
+
+            con_info->answercode = MHD_HTTP_OK;
+            return sendResponseText(connection, con_info->answerstring, con_info->answercode);
+        }
+        else if (0 == strcmp(url, "/SetDenoise"))
+        {
+            int enable;
+            if (!paramStrToInt(con_info->mParams, "enable", enable)) return MHD_NO;
+
+            if (m_pHLuminateServer->SetDenoise(con_info->sessionId, 0 != enable))
+                con_info->answerstring = response_success;
+            else
+                con_info->answerstring = response_error;
+
+            con_info->answercode = MHD_HTTP_OK;
+            return sendResponseText(connection, con_info->answerstring, con_info->answercode);
+        }
+        else if (0 == strcmp(url, "/SetConvergence"))
+        {
+            // threshold: largest RMS change of a tile between two passes, 0 to trace every pass
+            double threshold;
+            if (!paramStrToDbl(con_info->mParams, "threshold", threshold)) return MHD_NO;
+
+            int minPasses = 3;
+            paramStrToInt(con_info->mParams, "minPasses", minPasses);
+
+            if (m_pHLuminateServer->SetConvergenceThreshold(con_info->sessionId, (float)threshold, minPasses))
+                con_info->answerstring = response_success;
+            else
+                con_info->answerstring = response_error;
+
+            con_info->answercode = MHD_HTTP_OK;
+            return sendResponseText(connection, con_info->answerstring, con_info->answercode);
+        }
+        else if (0 == strcmp(url, "/SetRegionOfInterest"))
+        {
+            // left, top, right, bottom: window size relative, without them the whole view is traced again
+            // density: render pixels per window pixel along each axis (1 - 4)
+            ScreenRegion region;
+            double left, top, right, bottom;
+            bool bRegion = paramStrToDbl(con_info->mParams, "left", left) &&
+                paramStrToDbl(con_info->mParams, "top", top) &&
+                paramStrToDbl(con_info->mParams, "right", right) &&
+                paramStrToDbl(con_info->mParams, "bottom", bottom);
+
+            if (bRegion)
+            {
+                region.left = (float)left;
+                region.top = (float)top;
+                region.right = (float)right;
+                region.bottom = (float)bottom;
+            }
+
+            int density = 2;
+            paramStrToInt(con_info->mParams, "density", density);
+
+            if (m_pHLuminateServer->SetRegionOfInterest(con_info->sessionId, bRegion ? &region : NULL, density))
+                con_info->answerstring = response_success;
+            else
+                con_info->answerstring = response_error;
+
+            con_info->answercode = MHD_HTTP_OK;
+            return sendResponseText(connection, con_info->answerstring, con_info->answercode);
+        }
         else if (0 == strcmp(url, "/SetRootTransform"))
         { 
             double* matrix;
-            if (!paramStrToDblArr("matrix", matrix)) return MHD_NO;
+            if (!paramStrToDblArr(con_info->mParams, "matrix", matrix)) return MHD_NO;
 
             m_pHLuminateServer->SetModelTransform(con_info->sessionId, matrix);
 
@@ -819,6 +1415,48 @@ answer_to_connection(void* cls,
 
             return sendResponseText(connection, con_info->answerstring, con_info->answercode);
         }
+        else if (0 == strcmp(url, "/SetNodeMatrices"))
+        {
+            // nodeIds: PRC IDs, matrices: 16 values per node
+            std::vector<std::string> nodeIds, matrixArr;
+            if (!paramStrToStrArr(con_info->mParams, "nodeIds", nodeIds)) return MHD_NO;
+            if (!paramStrToStrArr(con_info->mParams, "matrices", matrixArr)) return MHD_NO;
+
+            con_info->answerstring = response_error;
+            if (16 * nodeIds.size() == matrixArr.size())
+            {
+                std::vector<double> matrices(matrixArr.size());
+                for (size_t i = 0; i < matrixArr.size(); i++)
+                    matrices[i] = std::atof(matrixArr[i].c_str());
+
+                if (m_pHLuminateServer->SetNodeMatrices(con_info->sessionId, nodeIds, matrices.data()))
+                    con_info->answerstring = response_success;
+            }
+
+            con_info->answercode = MHD_HTTP_OK;
+            return sendResponseText(connection, con_info->answerstring, con_info->answercode);
+        }
+        else if (0 == strcmp(url, "/SetNodesVisibility"))
+        {
+            // nodeIds: PRC IDs, visible: 0 or 1 per node
+            std::vector<std::string> nodeIds, visibleArr;
+            if (!paramStrToStrArr(con_info->mParams, "nodeIds", nodeIds)) return MHD_NO;
+            if (!paramStrToStrArr(con_info->mParams, "visible", visibleArr)) return MHD_NO;
+
+            con_info->answerstring = response_error;
+            if (nodeIds.size() == visibleArr.size())
+            {
+                std::vector<int> visibilities(visibleArr.size());
+                for (size_t i = 0; i < visibleArr.size(); i++)
+                    visibilities[i] = std::atoi(visibleArr[i].c_str());
+
+                if (m_pHLuminateServer->SetNodesVisibility(con_info->sessionId, nodeIds, visibilities.data()))
+                    con_info->answerstring = response_success;
+            }
+
+            con_info->answercode = MHD_HTTP_OK;
+            return sendResponseText(connection, con_info->answerstring, con_info->answercode);
+        }
         else if (0 == strcmp(url, "/DownloadImage"))
         {
             m_pHLuminateServer->DownloadImage(con_info->sessionId);
@@ -829,22 +1467,53 @@ answer_to_connection(void* cls,
         }
         else if (0 == strcmp(url, "/AddFloorMesh"))
         {
-            int pointCnt, faceCnt;
-            if (!paramStrToInt("pointCnt", pointCnt)) return MHD_NO;
-            if (!paramStrToInt("faceCnt", faceCnt)) return MHD_NO;
+            BinaryMesh mesh;
+            std::vector<float> points, uvs;
+            std::vector<int> indices;
 
-            double* points;
-            if (!paramStrToDblArr("points", points)) return MHD_NO;
-            
-            int* faceList;
-            if (!paramStrToIntArr("faceList", faceList)) return MHD_NO;
-
-            double* uvs;
-            if (!paramStrToDblArr("uvs", uvs)) return MHD_NO;
+            if (con_info->bRawBody)
+            {
+                // Binary mesh, its arrays are read in place
+                if (!parseBinaryMesh(con_info->body, mesh))
+                    return sendResponseText(connection, response_error, MHD_HTTP_OK);
+            }
+            else
+            {
+                // Form fields: pointCnt coordinates, faceCnt triangles, comma separated values
+                int pointCnt, faceCnt;
+                if (!paramStrToInt(con_info->mParams, "pointCnt", pointCnt)) return MHD_NO;
+                if (!paramStrToInt(con_info->mParams, "faceCnt", faceCnt)) return MHD_NO;
+
+                std::vector<std::string> pointArr, faceArr, uvArr;
+                if (!paramStrToStrArr(con_info->mParams, "points", pointArr)) return MHD_NO;
+                if (!paramStrToStrArr(con_info->mParams, "faceList", faceArr)) return MHD_NO;
+                if (!paramStrToStrArr(con_info->mParams, "uvs", uvArr)) return MHD_NO;
+
+                if (pointCnt != (int)pointArr.size() || 3 * faceCnt != (int)faceArr.size() || pointCnt / 3 * 2 != (int)uvArr.size())
+                    return sendResponseText(connection, response_error, MHD_HTTP_OK);
+
+                points.resize(pointArr.size());
+                for (size_t i = 0; i < pointArr.size(); i++)
+                    points[i] = (float)std::atof(pointArr[i].c_str());
+
+                indices.resize(faceArr.size());
+                for (size_t i = 0; i < faceArr.size(); i++)
+                    indices[i] = std::atoi(faceArr[i].c_str());
+
+                uvs.resize(uvArr.size());
+                for (size_t i = 0; i < uvArr.size(); i++)
+                    uvs[i] = (float)std::atof(uvArr[i].c_str());
+
+                mesh.vertexCount = pointCnt / 3;
+                mesh.triangleCount = faceCnt;
+                mesh.points = points.data();
+                mesh.indices = indices.data();
+                mesh.uvs = uvs.data();
+            }
 
             m_pHLuminateServer->DeleteFloorMesh(con_info->sessionId);
 
-            if (m_pHLuminateServer->AddFloorMesh(con_info->sessionId, pointCnt, points, faceCnt, faceList, uvs))
+            if (m_pHLuminateServer->AddFloorMesh(con_info->sessionId, mesh.vertexCount, mesh.points, mesh.triangleCount, mesh.indices, mesh.uvs))
                 con_info->answerstring = response_success;
             else
                 con_info->answerstring = response_error;
@@ -860,32 +1529,48 @@ answer_to_connection(void* cls,
             con_info->answercode = MHD_HTTP_OK;
             
             // Delete texture file
-            if (0 < strlen(s_floorTexturePath))
+            char floorTexturePath[FILENAME_MAX] = { '\0' };
+            {
+                std::lock_guard<std::mutex> lock(s_sessionMutex);
+                strcpy(floorTexturePath, s_mFloorTexturePath[con_info->sessionId].c_str());
+                s_mFloorTexturePath.erase(con_info->sessionId);
+                s_mFloorTextureHash.erase(con_info->sessionId);
+            }
+
+            if (0 < strlen(floorTexturePath))
             {
 #ifndef _WIN32
-                delete_files(s_floorTexturePath);
+                delete_files(floorTexturePath);
 #else
                 {
                     wchar_t wFilePath[_MAX_FNAME];
                     size_t iRet;
-                    mbstowcs_s(&iRet, wFilePath, _MAX_FNAME, s_floorTexturePath, _MAX_FNAME);
+                    mbstowcs_s(&iRet, wFilePath, _MAX_FNAME, floorTexturePath, _MAX_FNAME);
                     _wremove(wFilePath);
                 }
 #endif
             }
-            sprintf(s_floorTexturePath, "");
 
             return sendResponseText(connection, con_info->answerstring, con_info->answercode);
         }
         else if (0 == strcmp(url, "/UpdateFloorMaterial"))
         {
             double* color;
-            if (!paramStrToDblArr("color", color)) return MHD_NO;
+            if (!paramStrToDblArr(con_info->mParams, "color", color)) return MHD_NO;
 
             double textureScale;
-            if (!paramStrToDbl("textureScale", textureScale)) return MHD_NO;
+            if (!paramStrToDbl(con_info->mParams, "textureScale", textureScale)) return MHD_NO;
 
-            m_pHLuminateServer->UpdateFloorMaterial(con_info->sessionId, color, s_floorTexturePath, textureScale);
+            std::string floorTexturePath;
+            unsigned long long floorTextureHash;
+            {
+                std::lock_guard<std::mutex> lock(s_sessionMutex);
+                floorTexturePath = s_mFloorTexturePath[con_info->sessionId];
+                floorTextureHash = s_mFloorTextureHash[con_info->sessionId];
+            }
+
+            m_pHLuminateServer->UpdateFloorMaterial(con_info->sessionId, color, floorTexturePath.c_str(), floorTextureHash, textureScale);
+            delete[] color;
 
             con_info->answerstring = response_success;
             con_info->answercode = MHD_HTTP_OK;
@@ -900,8 +1585,8 @@ answer_to_connection(void* cls,
 int
 main(int argc, char** argv)
 {
-    if (argc != 2) {
-        printf("%s PORT\n",
+    if (argc < 2 || 4 < argc) {
+        printf("%s PORT [THREADS [NUMA_NODE]]\n",
             argv[0]);
         return 1;
     }
@@ -909,6 +1594,20 @@ main(int argc, char** argv)
     int iPort = atoi(argv[1]);
     printf("Bind to %d port\n", iPort);
 
+    // Soft tracer threads given by the host, until its scheduler rebalances them
+    int iThreads = 3 <= argc ? atoi(argv[2]) : 0;
+
+    // Tracing threads and scene memory stay on one node of a multi-socket host,
+    // every thread started from now on inherits the binding
+    int iNumaNode = 4 == argc ? atoi(argv[3]) : -1;
+    if (0 <= iNumaNode && 1 < getNumaNodeCount())
+    {
+        if (bindToNumaNode(iNumaNode))
+            printf("Bound to NUMA node %d\n", iNumaNode);
+        else
+            printf("Failed to bind to NUMA node %d\n", iNumaNode);
+    }
+
     pExProcess = new ExProcess();
     if (!pExProcess->Init())
     {
@@ -919,10 +1618,16 @@ main(int argc, char** argv)
 
     // Luminate
     m_pHLuminateServer = new HLuminateServer();
+    m_pHLuminateServer->PreloadLibMaterials(s_materialLibraryDir);
+    if (0 < iThreads)
+    {
+        printf("Soft tracer threads: %d\n", iThreads);
+        m_pHLuminateServer->SetThreadBudget(iThreads);
+    }
 
     struct MHD_Daemon* daemon;
 
-    daemon = MHD_start_daemon(MHD_USE_INTERNAL_POLLING_THREAD,
+    daemon = MHD_start_daemon(MHD_USE_INTERNAL_POLLING_THREAD | MHD_USE_THREAD_PER_CONNECTION,
         iPort, NULL, NULL,
         &answer_to_connection, NULL,
         MHD_OPTION_NOTIFY_COMPLETED, &request_completed,
@@ -935,11 +1640,18 @@ main(int argc, char** argv)
         return 1;
     }
 
-    bool bFlg = true;
-    while (bFlg)
+    // Console input also shuts the server down
+    std::thread([]() {
+        getchar();
+
+        std::lock_guard<std::mutex> lock(s_sessionMutex);
+        s_bShutdown = true;
+        s_shutdownCondition.notify_all();
+    }).detach();
+
     {
-        if (getchar())
-            bFlg = false;
+        std::unique_lock<std::mutex> lock(s_sessionMutex);
+        s_shutdownCondition.wait(lock, []() { return s_bShutdown; });
     }
     MHD_stop_daemon(daemon);
 
@@ -948,5 +1660,7 @@ main(int argc, char** argv)
     m_pHLuminateServer->Terminate();
     delete m_pHLuminateServer;
 
+    printf("HOOPS Luminate terminated\n");
+
     return 0;
 }
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <iostream>
 #include <fstream>
+#include <vector>
 #include <sys/stat.h>
 #ifndef _WIN32
 #include <dirent.h>
@@ -206,6 +207,169 @@ void getBaseName(const char* filename, char* basename)
 
 }
 
+bool file_exists(const char *filename)
+{
+	struct stat statbuf;
+	return 0 == stat(filename, &statbuf);
+}
+
+bool make_dir(const char *dir)
+{
+	if (file_exists(dir))
+		return true;
+
+#ifndef _WIN32
+	return 0 == mkdir(dir, 0777);
+#else
+	return 0 == _mkdir(dir);
+#endif
+}
+
+bool hash_file(const char *filename, unsigned long long &hash)
+{
+	// 64 bit FNV-1a
+	std::ifstream ifstr(filename, std::ios::binary);
+	if (!ifstr)
+		return false;
+
+	hash = 14695981039346656037ull;
+
+	std::vector<char> buffer(1 << 20);
+	while (ifstr)
+	{
+		ifstr.read(&buffer[0], buffer.size());
+		std::streamsize size = ifstr.gcount();
+		for (std::streamsize i = 0; i < size; i++)
+		{
+			hash ^= (unsigned char)buffer[i];
+			hash *= 1099511628211ull;
+		}
+	}
+
+	return true;
+}
+
+namespace
+{
+	// SHA-256 (FIPS 180-4)
+	const unsigned int s_sha256K[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	struct Sha256
+	{
+		unsigned int state[8];
+		unsigned char block[64];
+		size_t blockSize;
+		unsigned long long length;
+
+		Sha256() : blockSize(0), length(0)
+		{
+			const unsigned int init[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+			memcpy(state, init, sizeof(state));
+		}
+
+		static unsigned int rotr(unsigned int x, int n) { return (x >> n) | (x << (32 - n)); }
+
+		void transform()
+		{
+			unsigned int w[64];
+			for (int i = 0; i < 16; i++)
+				w[i] = ((unsigned int)block[i * 4] << 24) | ((unsigned int)block[i * 4 + 1] << 16) | ((unsigned int)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+			for (int i = 16; i < 64; i++)
+			{
+				unsigned int s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+				unsigned int s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+				w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+			}
+
+			unsigned int a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+			for (int i = 0; i < 64; i++)
+			{
+				unsigned int t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + s_sha256K[i] + w[i];
+				unsigned int t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+				h = g; g = f; f = e; e = d + t1;
+				d = c; c = b; b = a; a = t1 + t2;
+			}
+
+			state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+			state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+		}
+
+		void update(const unsigned char* data, size_t size)
+		{
+			length += size;
+			for (size_t i = 0; i < size; i++)
+			{
+				block[blockSize++] = data[i];
+				if (64 == blockSize)
+				{
+					transform();
+					blockSize = 0;
+				}
+			}
+		}
+
+		std::string finish()
+		{
+			unsigned long long bitLength = length * 8;
+			const unsigned char pad = 0x80;
+			update(&pad, 1);
+			const unsigned char zero = 0;
+			while (56 != blockSize)
+				update(&zero, 1);
+			for (int i = 7; i >= 0; i--)
+				block[blockSize++] = (unsigned char)(bitLength >> (i * 8));
+			transform();
+
+			char hex[65];
+			for (int i = 0; i < 8; i++)
+				snprintf(hex + i * 8, 9, "%08x", state[i]);
+			return std::string(hex, 64);
+		}
+	};
+}
+
+bool sha256_file(const char *filename, const char *suffix, std::string &digest)
+{
+	// Digest of the file content followed by the suffix
+	std::ifstream ifstr(filename, std::ios::binary);
+	if (!ifstr)
+		return false;
+
+	Sha256 sha;
+
+	std::vector<char> buffer(1 << 20);
+	while (ifstr)
+	{
+		ifstr.read(&buffer[0], buffer.size());
+		sha.update((const unsigned char*)&buffer[0], (size_t)ifstr.gcount());
+	}
+
+	if (NULL != suffix)
+		sha.update((const unsigned char*)suffix, strlen(suffix));
+
+	digest = sha.finish();
+	return true;
+}
+
+bool get_file_mtime(const char *filename, long long &mtime)
+{
+	struct stat statbuf;
+	if (0 != stat(filename, &statbuf))
+		return false;
+
+	mtime = (long long)statbuf.st_mtime;
+	return true;
+}
+
 #ifndef _WIN32
 void delete_files(char *dir)
 {
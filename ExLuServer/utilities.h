@@ -1,4 +1,5 @@
 #pragma once
+#include <string>
 
 void GetEnvironmentVariablePath(const char *varName, char *value, const bool isError);
 void copy_file(const char *oDstFilePath, const char *oSrcFilePath);
@@ -6,6 +7,11 @@ long get_file_size(const char *filename);
 char* load_file(const char *filename);
 void getLowerExtention(const char *filename, char *lowext, char *filetype);
 void getBaseName(const char* filename, char* basename);
+bool file_exists(const char *filename);
+bool make_dir(const char *dir);
+bool hash_file(const char *filename, unsigned long long &hash);
+bool sha256_file(const char *filename, const char *suffix, std::string &digest);
+bool get_file_mtime(const char *filename, long long &mtime);
 void delete_files(char *dir);
 #ifndef _WIN32
 void delete_files(char* dir);
@@ -10,6 +10,38 @@ class ServerCaller {
         this._sessionId = sessionId;
     }
 
+    GetFrameURL(format = "auto") {
+        // Current render image, encoded in memory by ExLuServer
+        // auto: JPEG while the frame is refined, PNG once converged
+        return this._exServerURL + "/Frame?session_id=" + this._sessionId + "&format=" + format;
+    }
+
+    GetEventsURL() {
+        // Server-Sent Events stream of the frame statistics, one "frame" event per pass
+        return this._exServerURL + "/Events?session_id=" + this._sessionId;
+    }
+
+    GetFrameTiles(baseFrameId) {
+        // Tiles of the render image changed since frame baseFrameId (0 for a full frame)
+        return new Promise((resolve, reject) => {
+            if (undefined == this._exServerURL || undefined == this._sessionId) reject();
+
+            const xhr = new XMLHttpRequest();
+            xhr.open("GET", this._exServerURL + "/FrameTiles?session_id=" + this._sessionId + "&base=" + baseFrameId, true);
+            xhr.responseType = "arraybuffer";
+
+            xhr.onload = () => {
+                if (200 == xhr.status) return resolve(xhr.response);
+                else return reject(xhr.statusText);
+            };
+            xhr.onerror = () => {
+                return reject(xhr.statusText);
+            };
+
+            xhr.send();
+        });
+    }
+
     CallServerPost(command, params = {}, retType = null) {
         return new Promise((resolve, reject) => {
             if (undefined == this._exServerURL || undefined == this._sessionId) reject;
@@ -52,6 +84,27 @@ class ServerCaller {
         });
     }
 
+    CallServerPostBinary(command, buffer) {
+        // Raw binary body (e.g. geometry), read as is by ExLuServer
+        return new Promise((resolve, reject) => {
+            if (undefined == this._exServerURL || undefined == this._sessionId) reject();
+
+            const xhr = new XMLHttpRequest();
+            xhr.open("POST", this._exServerURL + "/" + command + "?session_id=" + this._sessionId, true);
+            xhr.setRequestHeader('Content-Type', 'application/octet-stream');
+
+            xhr.onload = () => {
+                if (200 == xhr.status) return resolve(xhr.response);
+                else return reject(xhr.statusText);
+            };
+            xhr.onerror = () => {
+                return reject(xhr.statusText);
+            };
+
+            xhr.send(buffer);
+        });
+    }
+
     CallServerSubmitFile(formData) {
         return new Promise((resolve, reject) => {
             if (undefined == this._exServerURL || undefined == this._sessionId) reject;
@@ -19,8 +19,12 @@ class Main {
             "10.0": "cm",
             "1000.0": "m"
         };
-        this._timerId;
+        this._eventSource;
         this._isBusy;
+        this._hasPendingFrame;
+        this._isSyncingCamera;
+        this._hasPendingCamera;
+        this._frameEpoch;
         this._prevCamera;
         this._setMaterialOp;
         this._setMaterialOpHandle;
@@ -42,8 +46,13 @@ class Main {
         if (null != this._port) { this._isDebug = true; }
         this._viewerMode = viewerMode.toUpperCase();
         this._reverseProxy = reverseProxy;
-        this._timerId = null;
+        this._eventSource = null;
         this._isBusy = false;
+        this._hasPendingFrame = false;
+        this._isSyncingCamera = false;
+        this._hasPendingCamera = false;
+        this._frameEpoch = 0;
+        this._frameId = 0;
         this._floorMeshId = null;
         this._requestProcesServer(8080);
         this._requestExServerSession();
@@ -86,10 +95,18 @@ class Main {
                     this._viewer.view.axisTriad.setAnchor(Communicator.OverlayAnchor.LowerRightCorner);
                 },
                 camera: (camera) => {
+                    // While rendering, camera updates are streamed: ExLuServer traces
+                    // at a reduced resolution until the camera stops moving
+                    if ($('[data-command="Raytracing"]').data("on") && null != this._eventSource) {
+                        this._syncCamera();
+                        return;
+                    }
+
                     const root = this._viewer.model.getAbsoluteRootNode();
                     this._viewer.model.resetNodesOpacity([root]);
                     if (this._isAutoSlide) {
                         $('#backgroundImg').attr('src', 'css/images/default_background.png');
+                        this._showRenderCanvas(false);
                     }
                     $('#progress').hide();
 
@@ -110,7 +127,7 @@ class Main {
                 },
                 timeoutWarning: () => {
                     // If rendering process is going on, continue the process
-                    if (null != this._timerId) {
+                    if (null != this._eventSource) {
                         this._viewer.setClientTimeout(15, 14);
                     }
                 },
@@ -150,6 +167,24 @@ class Main {
             }, interval);
         });
 
+        // Render profile, applied without rebuilding the scene
+        $('#renderProfile').change((e) => {
+            const params = {
+                profile: $(e.currentTarget).val()
+            }
+
+            this._serverCaller.CallServerPost("SetRenderProfile", params);
+        });
+
+        // Denoise early passes of the streamed frames
+        $('#denoise').change((e) => {
+            const params = {
+                enable: $(e.currentTarget).prop("checked") ? 1 : 0
+            }
+
+            this._serverCaller.CallServerPost("SetDenoise", params);
+        });
+
         // Before page reload or close
         $(window).on('beforeunload', (e) => {
             if (this._isDebug) {
@@ -438,7 +473,7 @@ class Main {
                     this._deleteFloor();
                 } break;
                 case "Download": {
-                    const serverName = this._sessionId + "/image.png";
+                    const serverName = this._serverCaller.GetFrameURL("png");
                     const downloadName = "image.png";
                     this._downloadImage(serverName, downloadName);
 
@@ -524,6 +559,7 @@ class Main {
 
             // Set default backgrond image
             $('#backgroundImg').attr('src', 'css/images/default_background.png');
+            this._showRenderCanvas(false);
 
             // Load default lighting list from JSON file
             const lighting_url = "Lighting/lighting_list.json";
@@ -638,6 +674,7 @@ class Main {
         $("#loadingImage").show();
         const now = new Date().getTime();
         $('#backgroundImg').attr('src', 'css/images/default_background.png');
+        this._showRenderCanvas(false);
 
         await this._invokeNew();
 
@@ -682,6 +719,8 @@ class Main {
         await this._viewer.view.setCamera(camera);
 
         await this._serverCaller.CallServerPost("PrepareRendering", this._getRenderingParams());
+        await this._serverCaller.CallServerPost("SetRenderProfile", { profile: $('#renderProfile').val() });
+        await this._serverCaller.CallServerPost("SetDenoise", { enable: $('#denoise').prop("checked") ? 1 : 0 });
         $('[data-command="Raytracing"]').prop("disabled", false).css("background-color", "gainsboro");
         $("#loadingImage").hide();
     }
@@ -814,56 +853,163 @@ class Main {
         $('#progress').show();
         this._isAutoSlide = true;
 
-        this._timerId = setInterval(() => {
-            if (false == this._isBusy && 0 < this._timerId) {
-                this._isBusy = true;
-                this._serverCaller.CallServerPost("Draw", "{}", "FLOAT").then((arr) => {
-                    this._isBusy = false;
-                    if (arr.length && null != this._timerId) {
-                        const renderingIsDone = arr[0];
-                        const renderingProgress = arr[1] * 100;
-                        const remainingTimeMilliseconds = arr[2];
-                        const now = new Date().getTime();
-                        $('#backgroundImg').attr('src', this._sessionId + '/image.png?' + now);
-
-                        $("#progressBar").progressbar("value", renderingProgress);
-
-                        const root = this._viewer.model.getAbsoluteRootNode();
-                        const ratio = 5;
-                        if (ratio >= renderingProgress) {
-
-                            if (this._isAutoSlide) {
-                                const opacity = (ratio - renderingProgress) / ratio;
-                                this._viewer.model.setNodesOpacity([root], opacity);
-                                $("#opacitySlider").slider("value",opacity);
-                            }
-                        }
-                        else {
-                            if (this._isAutoSlide) {
-                                this._viewer.model.setNodesOpacity([root], 0);
-                                $("#opacitySlider").slider("value",0);
-                            }
-                        }
+        // ExLuServer pushes the statistics after each pass
+        this._closeEventSource();
+        this._eventSource = new EventSource(this._serverCaller.GetEventsURL());
+        this._eventSource.addEventListener("frame", (e) => {
+            this._onFrameEvent(JSON.parse(e.data));
+        });
+    }
 
-                        if (100 == renderingProgress) {
-                            this._clearRaytracing();
-                            $('#progress').hide();
-                            $('[data-command="Raytracing"]').data("on", false).css("background-color", "gainsboro");
-                        }
-                    }
-                });
+    _onFrameEvent(statistics) {
+        const renderingProgress = statistics.renderingProgress * 100;
+
+        this._requestFrameTiles();
+
+        $("#progressBar").progressbar("value", renderingProgress);
+
+        const root = this._viewer.model.getAbsoluteRootNode();
+        const ratio = 5;
+        if (ratio >= renderingProgress) {
+
+            if (this._isAutoSlide) {
+                const opacity = (ratio - renderingProgress) / ratio;
+                this._viewer.model.setNodesOpacity([root], opacity);
+                $("#opacitySlider").slider("value",opacity);
             }
-        }, 200);
+        }
+        else {
+            if (this._isAutoSlide) {
+                this._viewer.model.setNodesOpacity([root], 0);
+                $("#opacitySlider").slider("value",0);
+            }
+        }
+
+        if (100 == renderingProgress) {
+            // The last frame is still fetched
+            this._closeEventSource();
+            $('#progress').hide();
+            $('[data-command="Raytracing"]').data("on", false).css("background-color", "gainsboro");
+        }
     }
 
-    _clearRaytracing() {
-        if (null != this._timerId) {
-            clearInterval(this._timerId);
-            this._timerId = null;
+    _syncCamera() {
+        // One request in flight, the latest camera is sent when it returns
+        if (this._isSyncingCamera) {
+            this._hasPendingCamera = true;
+            return;
+        }
+
+        this._isSyncingCamera = true;
+        this._serverCaller.CallServerPost("SyncCamera", this._getRenderingParams()).then(() => {
+            this._isSyncingCamera = false;
+            if (this._hasPendingCamera) {
+                this._hasPendingCamera = false;
+                this._syncCamera();
+            }
+        }).catch(() => {
+            this._isSyncingCamera = false;
+        });
+    }
+
+    _requestFrameTiles() {
+        // Passes completed while tiles are fetched are coalesced into one request
+        if (this._isBusy) {
+            this._hasPendingFrame = true;
+            return;
+        }
+
+        this._isBusy = true;
+        this._updateFrameTiles(this._frameEpoch).then(() => {
             this._isBusy = false;
+            if (this._hasPendingFrame) {
+                this._hasPendingFrame = false;
+                this._requestFrameTiles();
+            }
+        });
+    }
+
+    _updateFrameTiles(epoch) {
+        // Composite the tiles changed since the last frame onto the background canvas
+        return this._serverCaller.GetFrameTiles(this._frameId).then((buffer) => {
+            const view = new DataView(buffer);
+            const frameId = view.getUint32(0, true);
+            const width = view.getUint16(4, true);
+            const height = view.getUint16(6, true);
+            const tileSize = view.getUint16(8, true);
+            const tileCount = view.getUint32(12, true);
+
+            // Resizing clears the canvas, only a full frame can be used as the next base
+            const canvas = document.getElementById("backgroundCanvas");
+            let isComplete = true;
+            if (canvas.width != width || canvas.height != height) {
+                canvas.width = width;
+                canvas.height = height;
+                isComplete = tileCount == Math.ceil(width / tileSize) * Math.ceil(height / tileSize);
+            }
+            const context = canvas.getContext("2d");
+
+            // Interactive frames have a reduced resolution, the browser upscales them
+            const size = this._viewer.view.getCanvasSize();
+            canvas.style.width = size.x + "px";
+            canvas.style.height = size.y + "px";
+
+            let offset = 16;
+            let decodes = [];
+            for (let i = 0; i < tileCount; i++) {
+                const column = view.getUint16(offset, true);
+                const row = view.getUint16(offset + 2, true);
+                const format = view.getUint8(offset + 4);
+                const size = view.getUint32(offset + 8, true);
+                offset += 12;
+
+                const blob = new Blob([new Uint8Array(buffer, offset, size)], { type: 2 == format ? "image/jpeg" : "image/png" });
+                offset += size;
+
+                decodes.push(createImageBitmap(blob).then((bitmap) => {
+                    context.drawImage(bitmap, column * tileSize, row * tileSize);
+                    bitmap.close();
+                }));
+            }
+
+            return Promise.all(decodes).then(() => {
+                this._frameId = isComplete ? frameId : 0;
+
+                // Rendering was cleared meanwhile, keep the canvas hidden
+                if (epoch == this._frameEpoch) {
+                    this._showRenderCanvas(true);
+                }
+            });
+        }).catch(() => {
+            this._frameId = 0;
+        });
+    }
+
+    _showRenderCanvas(show) {
+        // The canvas takes the place of the background image in the layout
+        if (show) {
+            $('#backgroundImg').hide();
+            $('#backgroundCanvas').show();
+        }
+        else {
+            $('#backgroundCanvas').hide();
+            $('#backgroundImg').show();
+        }
+    }
+
+    _closeEventSource() {
+        if (null != this._eventSource) {
+            this._eventSource.close();
+            this._eventSource = null;
         }
     }
 
+    _clearRaytracing() {
+        this._closeEventSource();
+        this._hasPendingFrame = false;
+        this._frameEpoch++;
+    }
+
     setMaterial(name) {
         const preserveColor = Number($("#checkPreserveColor").prop('checked'));
         const overrideMaterial = Number($("#checkOverrideMaterial").prop('checked'));
@@ -885,7 +1031,8 @@ class Main {
         let oReq = new XMLHttpRequest(),
             a = document.createElement('a'), file;
         let versioningNum = new Date().getTime()
-        oReq.open('GET', from + "?" + versioningNum, true);
+        const separator = from.includes("?") ? "&" : "?";
+        oReq.open('GET', from + separator + versioningNum, true);
         oReq.responseType = 'blob';
         oReq.onload = (oEvent) => {
             var blob = oReq.response;
@@ -911,6 +1058,27 @@ class Main {
         oReq.send();
     }
 
+    _encodeMesh(params) {
+        // Header (vertex count, triangle count, flags), positions, indices then UVs, little-endian
+        const vertexCount = params.points.length / 3;
+        const triangleCount = params.faceList.length / 3;
+        const hasUVs = params.uvs.length == vertexCount * 2;
+
+        const buffer = new ArrayBuffer(4 * (3 + params.points.length + params.faceList.length + (hasUVs ? params.uvs.length : 0)));
+        new Uint32Array(buffer, 0, 3).set([vertexCount, triangleCount, hasUVs ? 1 : 0]);
+
+        let offset = 12;
+        new Float32Array(buffer, offset, params.points.length).set(params.points);
+        offset += 4 * params.points.length;
+        new Uint32Array(buffer, offset, params.faceList.length).set(params.faceList);
+        offset += 4 * params.faceList.length;
+        if (hasUVs) {
+            new Float32Array(buffer, offset, params.uvs.length).set(params.uvs);
+        }
+
+        return buffer;
+    }
+
     async invokeCreateFloor(params) {
         // Create HC mesh
         if (null != this._floorMeshId) {
@@ -941,7 +1109,7 @@ class Main {
         const opacity = 1 - $('#colorA').val();
         this._viewer.model.setNodesOpacity([this._floorMeshId], opacity);
 
-        await this._serverCaller.CallServerPost("AddFloorMesh", params);
+        await this._serverCaller.CallServerPostBinary("AddFloorMesh", this._encodeMesh(params));
         this._updateFloorMaterial(null);
     }
 
@@ -995,6 +1163,7 @@ class Main {
         // Reset visibility
         this._clearRaytracing();
         $('#backgroundImg').attr('src', 'css/images/default_background.png');
+        this._showRenderCanvas(false);
         await this._viewer.model.resetNodesOpacity([root]);
 
         let roMatrix = new Communicator.Matrix();
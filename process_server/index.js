@@ -1,7 +1,14 @@
 const serverPORT = 8080;    // Port number of this server
 const startPort = 8888;     // Start port number of ExLuServer
 const processCnt = 10;      // Max count of ExLuServer instance
+const sessionsPerProcess = 4;   // Max count of sessions hosted by one ExLuServer instance
 const execPath = '..\\win64\\ExLuServer.exe';
+const hostThreads = Math.max(1, require('os').cpus().length - 2);  // Soft tracer threads shared by all instances
+const numaNodes = countNumaNodes();   // Instances are spread across the NUMA nodes of the host
+const nodeThreads = Math.max(1, Math.floor(hostThreads / numaNodes));  // Soft tracer threads of each node
+const rebalanceInterval = 500;  // Thread budget rebalancing interval (ms)
+const reclaimIdleTime = 30 * 60 * 1000;  // Instances without a request for this long may be reclaimed (ms)
+const reclaimStartTime = 60 * 1000;      // Grace period for the first session of a new instance (ms)
 let processMap = {};
 
 const http = require('http');
@@ -12,7 +19,21 @@ const server = http.createServer(function(req, res) {
 
     const createProcessInstance = (port) => {
         const exec = require('child_process').exec;
-        let cp = exec(execPath + ' ' + port, (err, stdout, stderr) => {
+        // Node hosting the fewest instances, its threads and memory stay there
+        let running = new Array(numaNodes).fill(0);
+        for (let key in processMap) {
+            const data = processMap[key];
+            if (undefined != data) running[data.node]++;
+        }
+        const node = running.indexOf(Math.min(...running));
+
+        // Even share of the node until the next rebalancing
+        const threads = Math.max(1, Math.floor(nodeThreads / (running[node] + 1)));
+
+        let args = ' ' + port + ' ' + threads;
+        if (1 < numaNodes) args += ' ' + node;
+
+        let cp = exec(execPath + args, (err, stdout, stderr) => {
             if (stdout) console.log('stdout', stdout);
             if (stderr) console.log('stderr', stderr);
             if (err !== null) console.log('err', err);
@@ -35,13 +56,17 @@ const server = http.createServer(function(req, res) {
                 processMap[port] = {
                     ppid: ppid,
                     pid: pid,
-                    time: new Date().getTime()
+                    time: new Date().getTime(),
+                    sessions: 1,
+                    threads: threads,
+                    node: node
                 }
 
                 console.log('  ExLuServer was started');
                 console.log('    PORT: ' + String(port));
                 console.log('    PPID: ' + ppid);
                 console.log('    PID:  ' + pid);
+                console.log('    NUMA node: ' + node);
 
                 ret.port =  port,
                 ret.pid = pid
@@ -70,6 +95,30 @@ const server = http.createServer(function(req, res) {
         const url = req.url;
         switch (url) {
             case '/start': {
+                // Share a running instance while it has room for another session
+                let shared = 0;
+                for (let key in processMap) {
+                    const data = processMap[key];
+                    if (undefined != data && sessionsPerProcess > data.sessions) {
+                        shared = Number(key);
+                        break;
+                    }
+                }
+                if (0 < shared) {
+                    const data = processMap[shared];
+                    data.sessions++;
+                    data.time = new Date().getTime();
+
+                    console.log('  ExLuServer is shared');
+                    console.log('    PORT: ' + String(shared));
+                    console.log('    PID:  ' + data.pid);
+                    console.log('    Sessions: ' + data.sessions);
+
+                    res.writeHead(200, {"Content-Type": "application/json"});
+                    res.end(JSON.stringify({port: shared, pid: data.pid}));
+                    break;
+                }
+
                 // Find unused port
                 let port = 0;
                 for (let i = startPort; i < startPort + processCnt; i++) {
@@ -84,19 +133,18 @@ const server = http.createServer(function(req, res) {
                     createProcessInstance(port);
                 }
                 else {
-                    // Kill the oldest port instance
-                    let pids = [];
+                    // Kill the instance idle for the longest, once its sessions are gone or abandoned.
+                    // Sessions and activity are reported by the instances at each rebalancing
                     const now = new Date().getTime();
                     let oldest = now;
                     for (let key in processMap) {
                         const data = processMap[key];
-                        const time = data.time;
-                        const deff = now - time;
-                        if (30 * 60 * 1000 < deff) {
-                            if (oldest > time) {
-                                oldest = time;
-                                port = Number(key);
-                            }
+                        if (undefined == data || undefined == data.activeTime) continue;
+                        const unused = 0 == data.runningSessions && reclaimStartTime < now - data.time;
+                        const abandoned = reclaimIdleTime < now - data.activeTime;
+                        if ((unused || abandoned) && oldest > data.activeTime) {
+                            oldest = data.activeTime;
+                            port = Number(key);
                         }
                     }
                     if (0 < port) {
@@ -130,8 +178,15 @@ const server = http.createServer(function(req, res) {
                         const data = processMap[killPort];
                         if (undefined != data) {
                             if (killPid == data.pid) {
-                                processMap[killPort] = undefined;
-                                console.log('  ExLuServer was terminated');
+                                // ExLuServer exits by itself when its last session is terminated
+                                data.sessions--;
+                                if (0 >= data.sessions) {
+                                    processMap[killPort] = undefined;
+                                    console.log('  ExLuServer was terminated');
+                                }
+                                else {
+                                    console.log('  ExLuServer session was terminated');
+                                }
                                 console.log('    PORT: ' + String(killPort));
                                 console.log('    PID:  ' + String(killPid));
                             }
@@ -147,6 +202,86 @@ const server = http.createServer(function(req, res) {
         }
     }
 }).listen(serverPORT, () => {
+    scheduleRebalance();
+
     console.log('Process server listening on port ' + serverPORT + '...');
 });
 
+
+// NUMA nodes listed by Linux or given by the NUMA_NODES environment variable, otherwise a single node
+function countNumaNodes() {
+    if (undefined != process.env.NUMA_NODES) return Math.max(1, Number(process.env.NUMA_NODES) || 1);
+    try {
+        const nodes = require('fs').readdirSync('/sys/devices/system/node').filter((name) => /^node\d+$/.test(name));
+        return Math.max(1, nodes.length);
+    } catch (e) {
+        return 1;
+    }
+}
+
+// Hand out the soft tracer threads of each NUMA node in proportion to the render demand of its instances.
+// Moving cameras weigh more than nearly converged frames, idle instances get no thread.
+// The answer also reports the sessions of the instance and the seconds since their last request.
+const callScheduler = (port, threads) => {
+    return new Promise((resolve) => {
+        const query = (undefined == threads) ? '' : '?threads=' + threads;
+        const req = http.get('http://localhost:' + port + '/Scheduler' + query, (res) => {
+            let data = '';
+            res.on('data', (chunk) => { data += chunk; });
+            res.on('end', () => {
+                try {
+                    resolve(JSON.parse(data));
+                } catch (e) {
+                    resolve(null);
+                }
+            });
+        }).on('error', () => {
+            resolve(null);
+        });
+
+        // A stalled instance must not hold up the next rounds
+        req.setTimeout(rebalanceInterval, () => req.destroy());
+    });
+}
+
+const rebalanceThreads = async () => {
+    const ports = Object.keys(processMap).filter((key) => undefined != processMap[key]);
+    if (0 == ports.length) return;
+
+    const states = await Promise.all(ports.map((port) => callScheduler(port)));
+    const now = new Date().getTime();
+
+    let demands = new Array(ports.length).fill(0);
+    let nodeDemands = new Array(numaNodes).fill(0);
+    for (let i = 0; i < ports.length; i++) {
+        const data = processMap[ports[i]];
+        if (undefined == data || null == states[i]) continue;
+
+        demands[i] = states[i].demand || 0;
+        data.runningSessions = states[i].sessions;
+        data.activeTime = now - 1000 * states[i].idle;
+        nodeDemands[data.node] += demands[i];
+    }
+
+    // Nodes without demand are rebalanced too, their instances give their threads back
+    let updates = [];
+    for (let i = 0; i < ports.length; i++) {
+        const data = processMap[ports[i]];
+        if (undefined == data) continue;
+
+        const threads = (0 < demands[i]) ? Math.max(1, Math.floor(nodeThreads * demands[i] / nodeDemands[data.node])) : 0;
+        if (threads != data.threads) {
+            data.threads = threads;
+            updates.push(callScheduler(ports[i], threads));
+        }
+    }
+    await Promise.all(updates);
+}
+
+// The next round starts once the previous one is over, calls never pile up
+const scheduleRebalance = () => {
+    setTimeout(async () => {
+        await rebalanceThreads();
+        scheduleRebalance();
+    }, rebalanceInterval);
+}